@@ -0,0 +1,340 @@
+// extent layer workload generator: drives extent_client with a mix of
+// create, put, get, getattr and remove over a working set of files, and
+// reports throughput, latency percentiles and the counters of the
+// layers below (disk block I/O, block and inode allocation, leases).
+//
+// usage: extent_bench [-t threads] [-n ops-per-thread] [-w files]
+//                     [-f fill] [-z sizes] [-m mix] [-r seed]
+//   -w   working set: files the workload runs over (default 200)
+//   -f   fraction of the disk filled beforehand with files the
+//        workload never touches, 0 to 0.9 (default 0)
+//   -z   put sizes: fixed:N, uniform:MIN:MAX or exp:MEAN bytes, at most
+//        MAXFILE blocks (default uniform:0:16384)
+//   -m   op weights (default create=5,put=25,get=40,getattr=25,remove=5)
+//
+// prints, after the run:
+//   op count ops-per-s p50-us p99-us p999-us errors
+//   counter total per-op
+//
+// extent_client talks to an in-process extent_server in this lab and
+// over RPC in later ones; the tool only uses its public calls, so the
+// same runs compare the two.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "extent_client.h"
+#include "inode_manager.h"
+#include "method_thread.h"
+#include "slock.h"
+#include "stats.h"
+
+enum op { CREATE, PUT, GET, GETATTR, REMOVE, NOPS };
+static const char *op_names[NOPS] = { "create", "put", "get", "getattr", "remove" };
+
+static const char *layer_counters[] = {
+  "disk.block_reads", "disk.block_writes", "block.allocs", "block.frees",
+  "inode.allocs", "inode.frees", "extent_client.lease_hits",
+  "extent_client.lease_misses",
+};
+static const int nlayer_counters = sizeof(layer_counters) / sizeof(layer_counters[0]);
+
+static const int max_file = MAXFILE * BLOCK_SIZE;
+
+// put sizes
+struct size_dist {
+  enum { FIXED, UNIFORM, EXP } kind;
+  int a, b;
+
+  bool parse(const char *s) {
+    if (sscanf(s, "fixed:%d", &a) == 1) {
+      kind = FIXED;
+      return a >= 0;
+    }
+    if (sscanf(s, "uniform:%d:%d", &a, &b) == 2) {
+      kind = UNIFORM;
+      return a >= 0 && b >= a;
+    }
+    if (sscanf(s, "exp:%d", &a) == 1) {
+      kind = EXP;
+      return a > 0;
+    }
+    return false;
+  }
+
+  int pick(unsigned int *seed) {
+    int n;
+    if (kind == FIXED)
+      n = a;
+    else if (kind == UNIFORM)
+      n = a + rand_r(seed) % (b - a + 1);
+    else {
+      // inverse transform; u in (0, 1]
+      double u = (rand_r(seed) + 1.0) / ((double) RAND_MAX + 1.0);
+      n = (int) (-log(u) * a);
+    }
+    return n < max_file ? n : max_file;
+  }
+};
+
+// the working set: one file per slot, or none after a remove. a slot's
+// lock is held across the op on it, so no op sees a removed extent.
+struct slot {
+  pthread_mutex_t m;
+  extent_protocol::extentid_t eid;  // 0 if empty
+};
+
+struct bench {
+  extent_client *ec;
+  std::vector<slot> slots;
+  size_dist sizes;
+  int weights[NOPS];
+  int total_weight;
+  int nops;
+  histogram *lat[NOPS];
+  uint64_t count[NOPS];
+  uint64_t errors[NOPS];
+  uint64_t skipped;  // no slot in the right state for the op
+  pthread_mutex_t m;  // protects count, errors, skipped
+};
+
+struct worker {
+  bench *b;
+  unsigned int seed;
+  void run();
+};
+
+static uint64_t
+now_ns()
+{
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// lock a random slot that is occupied (or empty, for create); NULL if
+// a few tries find none
+static slot *
+pick_slot(bench *b, unsigned int *seed, bool occupied)
+{
+  for (int i = 0; i < 8; i++) {
+    slot *s = &b->slots[rand_r(seed) % b->slots.size()];
+    VERIFY(pthread_mutex_lock(&s->m) == 0);
+    if ((s->eid != 0) == occupied)
+      return s;
+    VERIFY(pthread_mutex_unlock(&s->m) == 0);
+  }
+  return NULL;
+}
+
+void
+worker::run()
+{
+  uint64_t count[NOPS] = { 0 }, errors[NOPS] = { 0 }, skipped = 0;
+  std::string buf;
+  extent_protocol::attr a;
+
+  for (int i = 0; i < b->nops; i++) {
+    int w = rand_r(&seed) % b->total_weight, o = 0;
+    while (w >= b->weights[o])
+      w -= b->weights[o++];
+
+    slot *s = pick_slot(b, &seed, o != CREATE);
+    if (!s) {
+      skipped++;
+      continue;
+    }
+    if (o == PUT)
+      buf.assign(b->sizes.pick(&seed), 'p');
+
+    uint64_t start = now_ns();
+    extent_protocol::status r = extent_protocol::OK;
+    switch (o) {
+    case CREATE:
+      r = b->ec->create(extent_protocol::T_FILE, s->eid);
+      if (r != extent_protocol::OK)
+        s->eid = 0;
+      break;
+    case PUT:
+      r = b->ec->put(s->eid, buf);
+      break;
+    case GET:
+      r = b->ec->get(s->eid, buf);
+      break;
+    case GETATTR:
+      r = b->ec->getattr(s->eid, a);
+      break;
+    case REMOVE:
+      r = b->ec->remove(s->eid);
+      s->eid = 0;
+      break;
+    }
+    b->lat[o]->record(now_ns() - start);
+    VERIFY(pthread_mutex_unlock(&s->m) == 0);
+
+    count[o]++;
+    if (r != extent_protocol::OK)
+      errors[o]++;
+  }
+
+  ScopedLock ml(&b->m);
+  for (int o = 0; o < NOPS; o++) {
+    b->count[o] += count[o];
+    b->errors[o] += errors[o];
+  }
+  b->skipped += skipped;
+}
+
+static bool
+parse_mix(const char *s, int *weights)
+{
+  memset(weights, 0, NOPS * sizeof(int));
+  while (*s) {
+    int o, w, n;
+    for (o = 0; o < NOPS; o++) {
+      int len = strlen(op_names[o]);
+      if (!strncmp(s, op_names[o], len) && s[len] == '=')
+        break;
+    }
+    if (o == NOPS || sscanf(s + strlen(op_names[o]) + 1, "%d%n", &w, &n) != 1 || w < 0)
+      return false;
+    weights[o] = w;
+    s += strlen(op_names[o]) + 1 + n;
+    if (*s == ',')
+      s++;
+  }
+  return true;
+}
+
+static void
+usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-t threads] [-n ops-per-thread] [-w files] "
+          "[-f fill] [-z fixed:N|uniform:MIN:MAX|exp:MEAN] "
+          "[-m create=W,put=W,get=W,getattr=W,remove=W] [-r seed]\n", prog);
+  exit(1);
+}
+
+// create files of half the maximum size until fill of the disk is in
+// use, leaving inodes for the working set
+static int
+prefill(extent_client *ec, double fill, int reserve)
+{
+  std::string buf(max_file / 2, 'f');
+  long want = (long) (fill * DISK_SIZE), used = 0;
+  int n = 0;
+  while (used + (long) buf.size() <= want && n < INODE_NUM - 1 - reserve) {
+    extent_protocol::extentid_t eid;
+    if (ec->create(extent_protocol::T_FILE, eid) != extent_protocol::OK ||
+        ec->put(eid, buf) != extent_protocol::OK)
+      break;
+    used += buf.size();
+    n++;
+  }
+  return n;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nthreads = 1, nfiles = 200;
+  double fill = 0;
+  unsigned int seed = time(0);
+
+  bench b;
+  b.nops = 10000;
+  b.sizes.parse("uniform:0:16384");
+  parse_mix("create=5,put=25,get=40,getattr=25,remove=5", b.weights);
+
+  int ch;
+  while ((ch = getopt(argc, argv, "t:n:w:f:z:m:r:")) != -1) {
+    switch (ch) {
+    case 't': nthreads = atoi(optarg); break;
+    case 'n': b.nops = atoi(optarg); break;
+    case 'w': nfiles = atoi(optarg); break;
+    case 'f': fill = atof(optarg); break;
+    case 'z':
+      if (!b.sizes.parse(optarg))
+        usage(argv[0]);
+      break;
+    case 'm':
+      if (!parse_mix(optarg, b.weights))
+        usage(argv[0]);
+      break;
+    case 'r': seed = strtoul(optarg, NULL, 10); break;
+    default: usage(argv[0]);
+    }
+  }
+  b.total_weight = 0;
+  for (int o = 0; o < NOPS; o++)
+    b.total_weight += b.weights[o];
+  if (nthreads < 1 || b.nops < 0 || nfiles < 1 || nfiles >= INODE_NUM - 1 ||
+      fill < 0 || fill > 0.9 || b.total_weight == 0)
+    usage(argv[0]);
+
+  b.ec = new extent_client();
+  int filled = prefill(b.ec, fill, nfiles);
+
+  // the working set starts populated, each file with one put's worth
+  unsigned int s0 = seed;
+  b.slots.resize(nfiles);
+  for (int i = 0; i < nfiles; i++) {
+    VERIFY(pthread_mutex_init(&b.slots[i].m, 0) == 0);
+    VERIFY(b.ec->create(extent_protocol::T_FILE, b.slots[i].eid) == extent_protocol::OK);
+    std::string buf(b.sizes.pick(&s0), 'p');
+    b.ec->put(b.slots[i].eid, buf);
+  }
+
+  VERIFY(pthread_mutex_init(&b.m, 0) == 0);
+  for (int o = 0; o < NOPS; o++) {
+    b.lat[o] = new histogram(std::string("extent_bench.") + op_names[o] + "_ns");
+    b.count[o] = b.errors[o] = 0;
+  }
+  b.skipped = 0;
+
+  uint64_t before[nlayer_counters];
+  for (int i = 0; i < nlayer_counters; i++)
+    before[i] = stats_counter_value(layer_counters[i]);
+
+  std::vector<worker> w(nthreads);
+  std::vector<pthread_t> th;
+  uint64_t start = now_ns();
+  for (int i = 0; i < nthreads; i++) {
+    w[i].b = &b;
+    w[i].seed = seed + i + 1;
+    th.push_back(method_thread(&w[i], false, &worker::run));
+  }
+  for (int i = 0; i < nthreads; i++)
+    VERIFY(pthread_join(th[i], NULL) == 0);
+  double secs = (now_ns() - start) / 1e9;
+
+  uint64_t total = 0;
+  for (int o = 0; o < NOPS; o++)
+    total += b.count[o];
+
+  printf("# threads=%d ops=%llu files=%d prefilled=%d seconds=%.3f ops-per-s=%.0f skipped=%llu\n",
+         nthreads, (unsigned long long) total, nfiles, filled, secs,
+         total / secs, (unsigned long long) b.skipped);
+  printf("# op count ops-per-s p50-us p99-us p999-us errors\n");
+  for (int o = 0; o < NOPS; o++) {
+    if (!b.count[o])
+      continue;
+    printf("%s %llu %.0f %.1f %.1f %.1f %llu\n", op_names[o],
+           (unsigned long long) b.count[o], b.count[o] / secs,
+           b.lat[o]->percentile(0.50) / 1000.0, b.lat[o]->percentile(0.99) / 1000.0,
+           b.lat[o]->percentile(0.999) / 1000.0, (unsigned long long) b.errors[o]);
+  }
+  printf("# counter total per-op\n");
+  for (int i = 0; i < nlayer_counters; i++) {
+    uint64_t d = stats_counter_value(layer_counters[i]) - before[i];
+    printf("%s %llu %.2f\n", layer_counters[i], (unsigned long long) d,
+           total ? (double) d / total : 0.0);
+  }
+  return 0;
+}
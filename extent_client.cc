@@ -6,10 +6,37 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <time.h>
+#include "method_thread.h"
+#include "stats.h"
+
+static stat_counter lease_hits("extent_client.lease_hits");
+static stat_counter lease_misses("extent_client.lease_misses");
 
 extent_client::extent_client()
 {
   es = new extent_server();
+
+  VERIFY(pthread_mutex_init(&lease_m_, 0) == 0);
+  revokes_ = 0;
+  clt_nonce_ = random();
+  es->subscribe(clt_nonce_, this);
+
+  VERIFY(pthread_mutex_init(&aop_m_, 0) == 0);
+  aop_idle_ = 0;
+  aop_queued_ = 0;
+}
+
+extent_client::~extent_client()
+{
+  // a NULL aop tells a worker to exit
+  for (unsigned i = 0; i < workers_.size(); i++)
+    aopq_.enq(NULL);
+  for (unsigned i = 0; i < workers_.size(); i++)
+    VERIFY(pthread_join(workers_[i], NULL) == 0);
+
+  es->unsubscribe(clt_nonce_);
+  VERIFY(pthread_mutex_destroy(&lease_m_) == 0);
+  VERIFY(pthread_mutex_destroy(&aop_m_) == 0);
 }
 
 extent_protocol::status
@@ -33,7 +60,34 @@ extent_client::getattr(extent_protocol::extentid_t eid,
 		       extent_protocol::attr &attr)
 {
   extent_protocol::status ret = extent_protocol::OK;
-  ret = es->getattr(eid, attr);
+  unsigned int revokes;
+  {
+    ScopedLock ml(&lease_m_);
+    std::map<extent_protocol::extentid_t, lease>::iterator it = leases_.find(eid);
+    if (it != leases_.end()) {
+      if (time(0) < it->second.expire) {
+        attr = it->second.a;
+        lease_hits.add();
+        return ret;
+      }
+      leases_.erase(it);
+    }
+    revokes = revokes_;
+  }
+  lease_misses.add();
+
+  // the lease starts no later than the server's copy of it
+  time_t start = time(0);
+  ret = es->getattr_lease(eid, clt_nonce_, attr);
+  if (ret == extent_protocol::OK && attr.type != 0) {
+    ScopedLock ml(&lease_m_);
+    // a revoke that raced with the reply may be for this very grant
+    if (revokes == revokes_) {
+      lease &l = leases_[eid];
+      l.a = attr;
+      l.expire = start + extent_protocol::lease_time;
+    }
+  }
   return ret;
 }
 
@@ -55,4 +109,150 @@ extent_client::remove(extent_protocol::extentid_t eid)
   return ret;
 }
 
+int
+extent_client::revoke(extent_protocol::extentid_t eid)
+{
+  ScopedLock ml(&lease_m_);
+  leases_.erase(eid);
+  revokes_++;
+  return extent_protocol::OK;
+}
+
+// asynchronous operations -----------------------------------------
+
+extent_client::aop::aop(opcode o, extent_protocol::extentid_t e, acallback *c)
+  : op(o), type(0), eid(e), ret(extent_protocol::OK), cb_(c), done_(false)
+{
+  memset(&attr, 0, sizeof(attr));
+  VERIFY(pthread_mutex_init(&m_, 0) == 0);
+  VERIFY(pthread_cond_init(&c_, 0) == 0);
+}
+
+extent_client::aop::~aop()
+{
+  VERIFY(pthread_mutex_destroy(&m_) == 0);
+  VERIFY(pthread_cond_destroy(&c_) == 0);
+}
+
+extent_protocol::status
+extent_client::aop::wait()
+{
+  ScopedLock ml(&m_);
+  while (!done_)
+    VERIFY(pthread_cond_wait(&c_, &m_) == 0);
+  return ret;
+}
+
+bool
+extent_client::aop::done()
+{
+  ScopedLock ml(&m_);
+  return done_;
+}
+
+void
+extent_client::aop::complete(extent_protocol::status r)
+{
+  acallback *cb = cb_;
+
+  ret = r;
+  if (cb) {
+    // the callback owns the aop from here on, don't touch it after.
+    cb->done(this);
+    return;
+  }
+  ScopedLock ml(&m_);
+  done_ = true;
+  VERIFY(pthread_cond_broadcast(&c_) == 0);
+}
+
+void
+extent_client::aop_worker()
+{
+  while (1) {
+    aop *o;
+    extent_protocol::status r = extent_protocol::OK;
+
+    {
+      ScopedLock ml(&aop_m_);
+      aop_idle_++;
+    }
+    aopq_.deq(&o);
+    if (!o)
+      break;
+    {
+      ScopedLock ml(&aop_m_);
+      aop_idle_--;
+      aop_queued_--;
+    }
+    switch (o->op) {
+    case aop::CREATE:
+      r = create(o->type, o->eid);
+      break;
+    case aop::GET:
+      r = get(o->eid, o->buf);
+      break;
+    case aop::GETATTR:
+      r = getattr(o->eid, o->attr);
+      break;
+    case aop::PUT:
+      r = put(o->eid, o->buf);
+      o->buf.clear();
+      break;
+    case aop::REMOVE:
+      r = remove(o->eid);
+      break;
+    }
+    o->complete(r);
+  }
+}
+
+extent_client::aop *
+extent_client::aop_submit(aop *o)
+{
+  {
+    ScopedLock ml(&aop_m_);
+    // one worker per queued operation, up to AOP_WORKERS
+    aop_queued_++;
+    if (aop_queued_ > aop_idle_ && workers_.size() < AOP_WORKERS)
+      workers_.push_back(method_thread(this, false, &extent_client::aop_worker));
+  }
+  aopq_.enq(o);
+  return o;
+}
+
+extent_client::aop *
+extent_client::acreate(uint32_t type, acallback *cb)
+{
+  aop *o = new aop(aop::CREATE, 0, cb);
+  o->type = type;
+  return aop_submit(o);
+}
+
+extent_client::aop *
+extent_client::aget(extent_protocol::extentid_t eid, acallback *cb)
+{
+  return aop_submit(new aop(aop::GET, eid, cb));
+}
+
+extent_client::aop *
+extent_client::agetattr(extent_protocol::extentid_t eid, acallback *cb)
+{
+  return aop_submit(new aop(aop::GETATTR, eid, cb));
+}
+
+extent_client::aop *
+extent_client::aput(extent_protocol::extentid_t eid, std::string buf,
+                    acallback *cb)
+{
+  aop *o = new aop(aop::PUT, eid, cb);
+  o->buf.swap(buf);
+  return aop_submit(o);
+}
+
+extent_client::aop *
+extent_client::aremove(extent_protocol::extentid_t eid, acallback *cb)
+{
+  return aop_submit(new aop(aop::REMOVE, eid, cb));
+}
 
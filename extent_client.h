@@ -4,15 +4,89 @@
 #define extent_client_h
 
 #include <string>
+#include <vector>
+#include <map>
+#include <pthread.h>
+#include <time.h>
 #include "extent_protocol.h"
 #include "extent_server.h"
+#include "fifo.h"
+
+class extent_client : public extent_lease_holder {
+ public:
+  class acallback;
+
+  // an outstanding asynchronous operation, returned by the a*() calls.
+  // without a callback the caller wait()s on it and then deletes it;
+  // with a callback, ownership passes to acallback::done().
+  class aop {
+   public:
+    enum opcode { CREATE, GET, GETATTR, PUT, REMOVE };
+
+    aop(opcode o, extent_protocol::extentid_t e, acallback *c);
+    ~aop();
+
+    extent_protocol::status wait();
+    bool done();
+
+    opcode op;
+    uint32_t type;                   // CREATE
+    extent_protocol::extentid_t eid; // in, or out for CREATE
+    std::string buf;                 // in for PUT, out for GET
+    extent_protocol::attr attr;      // out for GETATTR
+    extent_protocol::status ret;
+
+   private:
+    friend class extent_client;
+    void complete(extent_protocol::status r);
+
+    acallback *cb_;
+    bool done_;
+    pthread_mutex_t m_;
+    pthread_cond_t c_;
+  };
+
+  // completion callback, run on one of the client's worker threads.
+  class acallback {
+   public:
+    virtual void done(aop *) = 0;
+    virtual ~acallback() {}
+  };
 
-class extent_client {
  private:
   extent_server *es;
+  unsigned int clt_nonce_;
+
+  // attributes cached under a server lease, answered locally until
+  // expire or until the server revokes them.
+  struct lease {
+    extent_protocol::attr a;
+    time_t expire;
+  };
+  std::map<extent_protocol::extentid_t, lease> leases_;
+  unsigned int revokes_; // bumped per revoke, see getattr()
+  pthread_mutex_t lease_m_;
+
+  // asynchronous operations are queued here and issued through the
+  // synchronous calls by a small pool of worker threads. a worker is
+  // started only when an operation is queued and none is idle, so a
+  // client that never uses the a*() calls has no threads. each worker
+  // carries one operation at a time: at most AOP_WORKERS are in flight
+  // and the rest wait in aopq_. with the extent_server behind RPC,
+  // issuing them through rpcc::call1_async() (rpc.h) would lift that
+  // limit without a thread per operation.
+  enum { AOP_WORKERS = 8 };
+  fifo<aop *> aopq_;
+  std::vector<pthread_t> workers_;
+  int aop_idle_;     // workers waiting on aopq_
+  int aop_queued_;   // operations in aopq_
+  pthread_mutex_t aop_m_;
+  void aop_worker();
+  aop *aop_submit(aop *o);
 
  public:
   extent_client();
+  ~extent_client();
 
   extent_protocol::status create(uint32_t type, extent_protocol::extentid_t &eid);
   extent_protocol::status get(extent_protocol::extentid_t eid, 
@@ -21,6 +95,17 @@ class extent_client {
 				                          extent_protocol::attr &a);
   extent_protocol::status put(extent_protocol::extentid_t eid, std::string buf);
   extent_protocol::status remove(extent_protocol::extentid_t eid);
+
+  // rextent_protocol::revoke handler
+  int revoke(extent_protocol::extentid_t eid);
+
+  // asynchronous variants; results are left in the returned aop.
+  aop *acreate(uint32_t type, acallback *cb = NULL);
+  aop *aget(extent_protocol::extentid_t eid, acallback *cb = NULL);
+  aop *agetattr(extent_protocol::extentid_t eid, acallback *cb = NULL);
+  aop *aput(extent_protocol::extentid_t eid, std::string buf,
+            acallback *cb = NULL);
+  aop *aremove(extent_protocol::extentid_t eid, acallback *cb = NULL);
 };
 
 #endif 
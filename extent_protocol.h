@@ -14,9 +14,13 @@ class extent_protocol {
     put = 0x6001,
     get,
     getattr,
-    remove
+    remove,
+    getattr_lease
   };
 
+  // seconds a getattr_lease reply may be answered from the client cache
+  static const int lease_time = 5;
+
   enum types {
     T_DIR = 1,
     T_FILE
@@ -31,6 +35,14 @@ class extent_protocol {
   };
 };
 
+// reverse protocol: server to lease holders
+class rextent_protocol {
+ public:
+  enum rpc_numbers {
+    revoke = 0x8101
+  };
+};
+
 inline unmarshall &
 operator>>(unmarshall &u, extent_protocol::attr &a)
 {
@@ -2,22 +2,28 @@
 
 #include "extent_server.h"
 #include <sstream>
+#include <vector>
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include "slock.h"
+#include "trace.h"
 
 extent_server::extent_server() 
 {
   im = new inode_manager();
+  VERIFY(pthread_mutex_init(&m_, 0) == 0);
 }
 
 int extent_server::create(uint32_t type, extent_protocol::extentid_t &id)
 {
+  ScopedLock ml(&m_);
+
   // alloc a new inode and return inum
-  printf("extent_server: create inode\n");
+  trace_log(JSL_DBG_4, "extent_server: create inode\n");
   id = im->alloc_inode(type);
 
   return extent_protocol::OK;
@@ -26,17 +32,23 @@ int extent_server::create(uint32_t type, extent_protocol::extentid_t &id)
 int extent_server::put(extent_protocol::extentid_t id, std::string buf, int &)
 {
   id &= 0x7fffffff;
-  
-  const char * cbuf = buf.c_str();
-  int size = buf.size();
-  im->write_file(id, cbuf, size);
-  
+
+  {
+    ScopedLock ml(&m_);
+    const char * cbuf = buf.c_str();
+    int size = buf.size();
+    im->write_file(id, cbuf, size);
+  }
+
+  revoke_leases(id);
   return extent_protocol::OK;
 }
 
 int extent_server::get(extent_protocol::extentid_t id, std::string &buf)
 {
-  printf("extent_server: get %lld\n", id);
+  ScopedLock ml(&m_);
+
+  trace_log(JSL_DBG_4, "extent_server: get %lld\n", id);
 
   id &= 0x7fffffff;
 
@@ -56,7 +68,9 @@ int extent_server::get(extent_protocol::extentid_t id, std::string &buf)
 
 int extent_server::getattr(extent_protocol::extentid_t id, extent_protocol::attr &a)
 {
-  printf("extent_server: getattr %lld\n", id);
+  ScopedLock ml(&m_);
+
+  trace_log(JSL_DBG_4, "extent_server: getattr %lld\n", id);
 
   id &= 0x7fffffff;
   
@@ -69,11 +83,72 @@ int extent_server::getattr(extent_protocol::extentid_t id, extent_protocol::attr
 
 int extent_server::remove(extent_protocol::extentid_t id, int &)
 {
-  printf("extent_server: write %lld\n", id);
+  trace_log(JSL_DBG_4, "extent_server: remove %lld\n", id);
+
+  id &= 0x7fffffff;
+
+  {
+    ScopedLock ml(&m_);
+    im->remove_file(id);
+  }
+
+  revoke_leases(id);
+  return extent_protocol::OK;
+}
+
+int extent_server::getattr_lease(extent_protocol::extentid_t id,
+                                 unsigned int clt_nonce,
+                                 extent_protocol::attr &a)
+{
+  ScopedLock ml(&m_);
 
   id &= 0x7fffffff;
-  im->remove_file(id);
- 
+
+  extent_protocol::attr attr;
+  memset(&attr, 0, sizeof(attr));
+  im->getattr(id, attr);
+  a = attr;
+
+  // no lease on a free inode: create() would have to revoke it
+  if (attr.type != 0 && holders_.count(clt_nonce))
+    leases_[id][clt_nonce] = time(0) + extent_protocol::lease_time;
   return extent_protocol::OK;
 }
 
+void extent_server::subscribe(unsigned int clt_nonce, extent_lease_holder *h)
+{
+  ScopedLock ml(&m_);
+  holders_[clt_nonce] = h;
+}
+
+void extent_server::unsubscribe(unsigned int clt_nonce)
+{
+  ScopedLock ml(&m_);
+  holders_.erase(clt_nonce);
+}
+
+// called without m_ held, after the modification is visible, so a
+// holder's next getattr_lease sees the new attributes.
+void extent_server::revoke_leases(extent_protocol::extentid_t id)
+{
+  std::vector<extent_lease_holder *> hs;
+  {
+    ScopedLock ml(&m_);
+    std::map<extent_protocol::extentid_t,
+             std::map<unsigned int, time_t> >::iterator it = leases_.find(id);
+    if (it == leases_.end())
+      return;
+
+    time_t now = time(0);
+    std::map<unsigned int, time_t>::iterator l;
+    for (l = it->second.begin(); l != it->second.end(); ++l) {
+      if (l->second <= now || !holders_.count(l->first))
+        continue;
+      hs.push_back(holders_[l->first]);
+    }
+    leases_.erase(it);
+  }
+
+  for (unsigned i = 0; i < hs.size(); i++)
+    hs[i]->revoke(id);
+}
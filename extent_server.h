@@ -5,9 +5,20 @@
 
 #include <string>
 #include <map>
+#include <pthread.h>
+#include <time.h>
 #include "extent_protocol.h"
 #include "inode_manager.h"
 
+// a client holding attribute leases. the server calls revoke() when an
+// extent it holds a lease on is modified; over RPC this is delivered as
+// rextent_protocol::revoke.
+class extent_lease_holder {
+ public:
+  virtual int revoke(extent_protocol::extentid_t id) = 0;
+  virtual ~extent_lease_holder() {}
+};
+
 class extent_server {
  protected:
 #if 0
@@ -18,6 +29,13 @@ class extent_server {
   std::map <extent_protocol::extentid_t, extent_t> extents;
 #endif
   inode_manager *im;
+  pthread_mutex_t m_; // serializes access to im
+
+  // outstanding attribute leases: extent -> client nonce -> expiry.
+  // protected by m_.
+  std::map<extent_protocol::extentid_t, std::map<unsigned int, time_t> > leases_;
+  std::map<unsigned int, extent_lease_holder *> holders_;
+  void revoke_leases(extent_protocol::extentid_t id);
 
  public:
   extent_server();
@@ -27,6 +45,12 @@ class extent_server {
   int get(extent_protocol::extentid_t id, std::string &);
   int getattr(extent_protocol::extentid_t id, extent_protocol::attr &);
   int remove(extent_protocol::extentid_t id, int &);
+
+  // getattr that also grants clt_nonce a lease of lease_time seconds
+  int getattr_lease(extent_protocol::extentid_t id, unsigned int clt_nonce,
+                    extent_protocol::attr &);
+  void subscribe(unsigned int clt_nonce, extent_lease_holder *h);
+  void unsubscribe(unsigned int clt_nonce);
 };
 
 #endif 
@@ -1,7 +1,16 @@
 #include "inode_manager.h"
+#include "trace.h"
+#include "stats.h"
 #include <cstring>
 #include <ctime>
 
+static stat_counter block_reads("disk.block_reads");
+static stat_counter block_writes("disk.block_writes");
+static stat_counter block_allocs("block.allocs");
+static stat_counter block_frees("block.frees");
+static stat_counter inode_allocs("inode.allocs");
+static stat_counter inode_frees("inode.frees");
+
 // disk layer -----------------------------------------
 
 disk::disk()
@@ -20,11 +29,12 @@ disk::read_block(blockid_t id, char *buf)
    *hint: use memcpy
   */
   if (id < 0 || id >= BLOCK_NUM || buf == NULL) {
-    printf("\tim: error! invalid blockid %d\n", id);
+    trace_log(JSL_DBG_2, "\tim: error! invalid blockid %d\n", id);
     return;
   }
 
   std::memcpy(buf, blocks[id], BLOCK_SIZE);
+  block_reads.add();
 }
 
 void
@@ -35,11 +45,12 @@ disk::write_block(blockid_t id, const char *buf)
    *hint: just like read_block
   */
   if (id < 0 || id >= BLOCK_NUM || buf == NULL) {
-    printf("\tim: error! invalid blockid %d\n", id);
+    trace_log(JSL_DBG_2, "\tim: error! invalid blockid %d\n", id);
     return;
   }
 
   std::memcpy(blocks[id], buf, BLOCK_SIZE);
+  block_writes.add();
 }
 
 // block layer -----------------------------------------
@@ -67,6 +78,7 @@ block_manager::alloc_block()
         if ((buf[i] & mask) == 0) {
           buf[i] = buf[i] | mask;
           write_block(BBLOCK(cur), buf);
+          block_allocs.add();
           return cur;
         }
         mask = mask >> 1;
@@ -74,7 +86,7 @@ block_manager::alloc_block()
       }
     }
   }
-  printf("\tim: error! out of blocks\n");
+  trace_log(JSL_DBG_1, "\tim: error! out of blocks\n");
   exit(0);
 }
 
@@ -93,6 +105,7 @@ block_manager::free_block(uint32_t id)
   buf[index] = buf[index] & mask;
 
   write_block(BBLOCK(id), buf);
+  block_frees.add();
 }
 
 // The layout of disk should be like this:
@@ -147,7 +160,7 @@ inode_manager::inode_manager()
   bm = new block_manager();
   uint32_t root_dir = alloc_inode(extent_protocol::T_DIR);
   if (root_dir != 1) {
-    printf("\tim: error! alloc first inode %d, should be 1\n", root_dir);
+    trace_log(JSL_DBG_1, "\tim: error! alloc first inode %d, should be 1\n", root_dir);
     exit(0);
   }
 }
@@ -177,12 +190,13 @@ inode_manager::alloc_inode(uint32_t type)
         ino->mtime = std::time(0);
         ino->ctime = std::time(0);
         bm->write_block(IBLOCK(cur, bm->sb.nblocks), buf);
+        inode_allocs.add();
         return cur;
       }
       ++cur;
     }
   }
-  printf("\tim: error! out of inodes\n");
+  trace_log(JSL_DBG_1, "\tim: error! out of inodes\n");
   exit(0);
 }
 
@@ -199,11 +213,12 @@ inode_manager::free_inode(uint32_t inum)
   bm->read_block(IBLOCK(inum, bm->sb.nblocks), buf);
   inode_t * ino = (inode_t *)buf + (inum - 1) % IPB;
   if (ino->type == 0) {
-    printf("\tim: error! inode is already freed\n");
+    trace_log(JSL_DBG_1, "\tim: error! inode is already freed\n");
     exit(0);
   } else {
     ino->type = 0;
     bm->write_block(IBLOCK(inum, bm->sb.nblocks), buf);
+    inode_frees.add();
   }
 }
 
@@ -215,10 +230,10 @@ inode_manager::get_inode(uint32_t inum)
   struct inode *ino, *ino_disk;
   char buf[BLOCK_SIZE];
 
-  printf("\tim: get_inode %d\n", inum);
+  trace_log(JSL_DBG_4, "\tim: get_inode %d\n", inum);
 
   if (inum <= 0 || inum > INODE_NUM) {
-    printf("\tim: inum out of range\n");
+    trace_log(JSL_DBG_2, "\tim: inum out of range\n");
     return NULL;
   }
 
@@ -227,7 +242,7 @@ inode_manager::get_inode(uint32_t inum)
 
   ino_disk = (struct inode*)buf + inum%IPB;
   if (ino_disk->type == 0) {
-    printf("\tim: inode not exist\n");
+    trace_log(JSL_DBG_3, "\tim: inode not exist\n");
     return NULL;
   }
 
@@ -243,7 +258,7 @@ inode_manager::put_inode(uint32_t inum, struct inode *ino)
   char buf[BLOCK_SIZE];
   struct inode *ino_disk;
 
-  printf("\tim: put_inode %d\n", inum);
+  trace_log(JSL_DBG_4, "\tim: put_inode %d\n", inum);
   if (ino == NULL)
     return;
 
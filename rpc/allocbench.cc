@@ -0,0 +1,204 @@
+// allocation benchmark: heap calls per RPC, client and server together,
+// with the slab allocator (slab.h) off and then on. an rpcs and an rpcc
+// in this process echo a string over loopback; malloc, calloc and
+// realloc are interposed and counted, which covers operator new too.
+//
+// usage: allocbench [-n calls] [-b bytes,...] [-t threads]
+// prints one line per payload size and setting:
+//   slab bytes calls mallocs-per-rpc frees-per-rpc ops-per-s
+// slab allocations themselves are not heap calls, so "on" counts only
+// what the slabs don't serve: std::string and map nodes, and blocks
+// over SLAB_MAX.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "rpc.h"
+#include "method_thread.h"
+#include "slab.h"
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t);
+void *__libc_calloc(size_t, size_t);
+void *__libc_realloc(void *, size_t);
+void __libc_free(void *);
+}
+
+static uint64_t nmalloc, nfree;
+
+extern "C" void *
+malloc(size_t n)
+{
+	__atomic_add_fetch(&nmalloc, 1, __ATOMIC_RELAXED);
+	return __libc_malloc(n);
+}
+
+extern "C" void *
+calloc(size_t n, size_t sz)
+{
+	__atomic_add_fetch(&nmalloc, 1, __ATOMIC_RELAXED);
+	return __libc_calloc(n, sz);
+}
+
+extern "C" void *
+realloc(void *p, size_t n)
+{
+	__atomic_add_fetch(&nmalloc, 1, __ATOMIC_RELAXED);
+	return __libc_realloc(p, n);
+}
+
+extern "C" void
+free(void *p)
+{
+	if (p)
+		__atomic_add_fetch(&nfree, 1, __ATOMIC_RELAXED);
+	__libc_free(p);
+}
+#else
+#error "allocbench counts heap calls by interposing glibc's malloc"
+#endif
+
+enum {
+	echo_proc = 0x7200,
+};
+
+class bench_srv {
+	public:
+		int echo(std::string s, std::string &r) { r = s; return 0; }
+};
+
+struct caller {
+	rpcc *cl;
+	std::string payload;
+	int n;
+	int errors;
+
+	void run() {
+		std::string r;
+		for (int i = 0; i < n; i++)
+			if (cl->call(echo_proc, payload, r) != 0)
+				errors++;
+	}
+};
+
+static uint64_t
+now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+// n calls spread over nthreads; heap calls and errors are for all of them
+static void
+calls(rpcc *cl, int bytes, int nthreads, int n, uint64_t *mallocs,
+		uint64_t *frees, uint64_t *ns)
+{
+	std::vector<caller> c(nthreads);
+	for (int i = 0; i < nthreads; i++) {
+		c[i].cl = cl;
+		c[i].payload.assign(bytes, 'x');
+		c[i].n = n / nthreads;
+		c[i].errors = 0;
+	}
+	// starting the threads counts too, a few calls in n
+	std::vector<pthread_t> th(nthreads);
+	uint64_t m0 = __atomic_load_n(&nmalloc, __ATOMIC_RELAXED);
+	uint64_t f0 = __atomic_load_n(&nfree, __ATOMIC_RELAXED);
+	uint64_t t0 = now_ns();
+	for (int i = 0; i < nthreads; i++)
+		th[i] = method_thread(&c[i], false, &caller::run);
+	int errors = 0;
+	for (int i = 0; i < nthreads; i++) {
+		VERIFY(pthread_join(th[i], NULL) == 0);
+		errors += c[i].errors;
+	}
+	*ns = now_ns() - t0;
+	*mallocs = __atomic_load_n(&nmalloc, __ATOMIC_RELAXED) - m0;
+	*frees = __atomic_load_n(&nfree, __ATOMIC_RELAXED) - f0;
+	if (errors)
+		fprintf(stderr, "allocbench: %d calls failed\n", errors);
+}
+
+static void
+run(rpcc *cl, bool slab, int bytes, int nthreads, int n)
+{
+	slab_enable(slab);
+	uint64_t m, f, ns;
+	// warm up: connections, the reply window, this setting's spans
+	calls(cl, bytes, nthreads, n / 10 + nthreads, &m, &f, &ns);
+	calls(cl, bytes, nthreads, n, &m, &f, &ns);
+	int done = n / nthreads * nthreads;
+	printf("%s %d %d %.2f %.2f %.0f\n", slab ? "on" : "off", bytes, done,
+			(double) m / done, (double) f / done, done * 1e9 / ns);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n calls] [-b bytes,...] [-t threads]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int n = 20000;
+	int nthreads = 1;
+	std::vector<int> sizes;
+	int ch;
+	while ((ch = getopt(argc, argv, "n:b:t:")) != -1) {
+		switch (ch) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'b':
+			for (char *s = strtok(optarg, ","); s; s = strtok(NULL, ","))
+				sizes.push_back(atoi(s));
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (n <= 0 || nthreads <= 0 || n < nthreads)
+		usage(argv[0]);
+	if (sizes.empty()) {
+		sizes.push_back(16);
+		sizes.push_back(1024);
+		sizes.push_back(8192);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	int port = 20000 + getpid() % 10000;
+	char dst[32];
+	snprintf(dst, sizeof(dst), "127.0.0.1:%d", port);
+	bench_srv b;
+	rpcs s(port);
+	s.reg(echo_proc, &b, &bench_srv::echo);
+
+	sockaddr_in addr;
+	make_sockaddr(dst, &addr);
+	rpcc cl(addr);
+	if (cl.bind() < 0) {
+		fprintf(stderr, "allocbench: cannot bind to %s\n", dst);
+		exit(1);
+	}
+
+	printf("# slab bytes calls mallocs-per-rpc frees-per-rpc ops-per-s\n");
+	for (unsigned i = 0; i < sizes.size(); i++) {
+		run(&cl, false, sizes[i], nthreads, n);
+		run(&cl, true, sizes[i], nthreads, n);
+	}
+	return 0;
+}
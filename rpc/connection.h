@@ -10,6 +10,7 @@
 #include <map>
 
 #include "pollmgr.h"
+#include "netem.h"
 
 class connection;
 
@@ -36,13 +37,23 @@ class connection : public aio_callback {
 		bool isdead();
 		void closeconn();
 
-		bool send(char *b, int sz);
+		// virtual so other transports (shmconn) can carry the same
+		// PDUs; read_cb/write_cb already are through aio_callback.
+		virtual bool send(char *b, int sz);
 		void write_cb(int s);
 		void read_cb(int s);
 
 		void incref();
 		void decref();
 		int ref();
+
+		// emulate a slower, longer link for the PDUs this end receives
+		// (netem.h); before any arrive. connections start with the
+		// RPC_NETEM settings, if any.
+		void set_netem(const netem_params &p) {
+			delete netem_;
+			netem_ = p.active() ? new netem(p) : NULL;
+		}
                 
                 int compare(connection *another);
 	private:
@@ -50,6 +61,15 @@ class connection : public aio_callback {
 		bool readpdu();
 		bool writepdu();
 
+	protected:
+		// hand a whole received PDU up, through netem_ if set
+		bool deliver(char *b, int sz) {
+			if (!netem_)
+				return mgr_->got_pdu(this, b, sz);
+			netem_->deliver(mgr_, this, b, sz);
+			return true;
+		}
+
 		chanmgr *mgr_;
 		const int fd_;
 		bool dead_;
@@ -62,6 +82,7 @@ class connection : public aio_callback {
 		int waiters_;
 		int refno_;
 		const int lossy_;
+		netem *netem_ = NULL;
 
 		pthread_mutex_t m_;
 		pthread_mutex_t ref_m_;
@@ -98,4 +119,5 @@ struct bundle {
 
 void start_accept_thread(chanmgr *mgr, int port, pthread_t *th, int *fd = NULL, int lossy=0);
 connection *connect_to_dst(const sockaddr_in &dst, chanmgr *mgr, int lossy=0);
+// AF_UNIX and shared-memory peers on the same host: see localconn.h
 #endif
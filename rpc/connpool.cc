@@ -0,0 +1,86 @@
+#include <stdlib.h>
+
+#include "connpool.h"
+#include "slock.h"
+#include "stats.h"
+#include "jsl_log.h"
+
+static stat_counter pool_connects("connpool.connects");
+
+connpool::connpool(connector *c) : conn_(c), slots_(NULL), n_(0)
+{
+	int n = 1;
+	const char *e = getenv("RPC_STREAMS");
+	if (e && atoi(e) > 0)
+		n = atoi(e);
+	alloc(n);
+}
+
+connpool::~connpool()
+{
+	release();
+}
+
+void
+connpool::alloc(int n)
+{
+	n_ = n;
+	slots_ = new slot[n_];
+	for (int i = 0; i < n_; i++) {
+		VERIFY(pthread_mutex_init(&slots_[i].m, 0) == 0);
+		slots_[i].c = NULL;
+	}
+}
+
+void
+connpool::release()
+{
+	close();
+	for (int i = 0; i < n_; i++)
+		VERIFY(pthread_mutex_destroy(&slots_[i].m) == 0);
+	delete[] slots_;
+	slots_ = NULL;
+}
+
+// only before the pool is in use
+void
+connpool::set_size(int n)
+{
+	VERIFY(n > 0);
+	if (n == n_)
+		return;
+	release();
+	alloc(n);
+}
+
+connection *
+connpool::get(unsigned int xid)
+{
+	slot &s = slots_[xid % n_];
+	ScopedLock ml(&s.m);
+	if (!s.c || s.c->isdead()) {
+		if (s.c)
+			s.c->decref();
+		s.c = conn_->connect();
+		if (!s.c) {
+			jsl_log(JSL_DBG_2, "connpool::get stream %d connect failed\n", xid % n_);
+			return NULL;
+		}
+		pool_connects.add();
+	}
+	s.c->incref();
+	return s.c;
+}
+
+void
+connpool::close()
+{
+	for (int i = 0; i < n_; i++) {
+		ScopedLock ml(&slots_[i].m);
+		if (slots_[i].c) {
+			slots_[i].c->closeconn();
+			slots_[i].c->decref();
+			slots_[i].c = NULL;
+		}
+	}
+}
@@ -0,0 +1,55 @@
+#ifndef connpool_h
+#define connpool_h
+
+// a fixed number of connections (streams) from one rpcc to one server.
+//
+// get(xid) stripes calls over the streams by xid, so concurrent calls
+// don't all queue behind one socket and one connection lock, while a
+// retransmission of an xid goes out on the same stream as the original.
+// replies are matched to callers by xid, and the server's at-most-once
+// state is keyed by clt_nonce, so neither cares which stream a PDU used.
+//
+// each stream is (re)connected lazily and independently: a dead stream
+// is replaced the next time a call maps to it, without holding up calls
+// on the others. the stream count is set before use, by set_size() or
+// the RPC_STREAMS environment variable (default 1).
+
+#include <pthread.h>
+#include "connection.h"
+
+class connpool {
+	public:
+		class connector {
+			public:
+				// a new connection with one reference, or NULL
+				virtual connection *connect() = 0;
+				virtual ~connector() { }
+		};
+
+		connpool(connector *c);
+		~connpool();
+
+		void set_size(int n);
+		int size() { return n_; }
+
+		// a referenced connection for xid's stream, connecting it if
+		// needed; NULL if that fails. the caller decref()s it.
+		connection *get(unsigned int xid);
+		// close and drop every stream; later get()s reconnect
+		void close();
+
+	private:
+		struct slot {
+			pthread_mutex_t m;
+			connection *c;
+		} __attribute__((aligned(64)));
+
+		connector *conn_;
+		slot *slots_;
+		int n_;
+
+		void alloc(int n);
+		void release();
+};
+
+#endif
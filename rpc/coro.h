@@ -0,0 +1,172 @@
+#ifndef coro_h
+#define coro_h
+
+// coroutines for rpc handlers and callers (C++20; make CORO=1).
+//
+// a handler registered with rpcs::reg_async() returns rpc_task<int>
+// and may co_await rpcc::acall() on other servers: while it waits it is
+// a suspended frame, not a blocked dispatch thread, so a few threads
+// can have thousands of such calls outstanding.
+//
+// rpc_task<T> starts lazily. co_await runs it and resumes the awaiting
+// coroutine when it finishes; start() runs it and calls a plain
+// function instead, for the dispatcher. a coroutine woken by a reply
+// carries on in a ThrPool job (rpc_coro_pool() by default), never on
+// the poll thread that saw the reply, since it may block before its
+// next co_await.
+//
+// the thread-local RPC deadline (deadline.h) does not follow a
+// coroutine from one thread to the next.
+//
+// without compiler support for coroutines this header defines nothing
+// and RPC_CORO stays undefined.
+
+#if defined(__cpp_impl_coroutine) && __cpp_impl_coroutine >= 201902L
+
+#define RPC_CORO 1
+
+#include <coroutine>
+#include <exception>
+#include <pthread.h>
+#include <type_traits>
+#include <utility>
+
+#include "thr_pool.h"
+#include "slock.h"
+
+class rpc_task_promise_base {
+	public:
+		rpc_task_promise_base() : done_(NULL), arg_(NULL) { }
+
+		std::suspend_always initial_suspend() noexcept { return std::suspend_always(); }
+
+		// hand control back to whoever is waiting: the awaiting
+		// coroutine, or done_(arg_), which may destroy the frame
+		struct final_awaiter {
+			bool await_ready() noexcept { return false; }
+			template<class P> std::coroutine_handle<>
+				await_suspend(std::coroutine_handle<P> h) noexcept {
+					rpc_task_promise_base &p = h.promise();
+					if (p.cont_)
+						return p.cont_;
+					if (p.done_)
+						p.done_(p.arg_);
+					return std::noop_coroutine();
+				}
+			void await_resume() noexcept { }
+		};
+		final_awaiter final_suspend() noexcept { return final_awaiter(); }
+
+		// the rpc library doesn't throw
+		void unhandled_exception() { std::terminate(); }
+
+		std::coroutine_handle<> cont_;
+		void (*done_)(void *);
+		void *arg_;
+};
+
+template<class T>
+class rpc_task_promise : public rpc_task_promise_base {
+	public:
+		void return_value(T v) { value_ = std::move(v); }
+		T &result() { return value_; }
+		T take() { return std::move(value_); }
+	private:
+		T value_;
+};
+
+template<>
+class rpc_task_promise<void> : public rpc_task_promise_base {
+	public:
+		void return_void() { }
+		void result() { }
+		void take() { }
+};
+
+template<class T>
+class rpc_task {
+	public:
+		struct promise_type : rpc_task_promise<T> {
+			rpc_task get_return_object() {
+				return rpc_task(std::coroutine_handle<promise_type>::from_promise(*this));
+			}
+		};
+		typedef std::coroutine_handle<promise_type> handle_t;
+
+		rpc_task(rpc_task &&o) : h_(o.h_) { o.h_ = NULL; }
+		rpc_task(const rpc_task &) = delete;
+		rpc_task &operator=(const rpc_task &) = delete;
+		~rpc_task() {
+			if (h_)
+				h_.destroy();
+		}
+
+		// co_await: run to completion, then resume the awaiter
+		bool await_ready() { return false; }
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> c) {
+			h_.promise().cont_ = c;
+			return h_;
+		}
+		T await_resume() { return h_.promise().take(); }
+
+		// run with nobody to resume: done(arg) once the task has finished,
+		// on whichever thread finishes it, possibly before start()
+		// returns. result() is valid from then on, and done may destroy
+		// the task.
+		void start(void (*done)(void *), void *arg) {
+			h_.promise().done_ = done;
+			h_.promise().arg_ = arg;
+			h_.resume();
+		}
+		typename std::add_lvalue_reference<T>::type result() {
+			return h_.promise().result();
+		}
+
+	private:
+		explicit rpc_task(handle_t h) : h_(h) { }
+		handle_t h_;
+};
+
+// continue h in a job on pool, or rpc_coro_pool() if NULL. never
+// resumes it on the calling thread, which may be the poll thread: if
+// the pool turns the job away, h waits on an unbounded overflow queue
+// that a thread of its own drains.
+void rpc_resume(std::coroutine_handle<> h, ThrPool *pool = NULL);
+
+// the pool coroutines carry on in after an rpcc::acall(); created on
+// first use and never destroyed
+ThrPool *rpc_coro_pool();
+
+// start t and block the calling thread until it has finished; for a
+// coroutine handler called by a dispatcher that can't wait for it
+template<class T> typename std::add_lvalue_reference<T>::type
+rpc_sync_wait(rpc_task<T> &t)
+{
+	struct waiter {
+		pthread_mutex_t m;
+		pthread_cond_t c;
+		bool done;
+		static void wake(void *a) {
+			waiter *w = (waiter *) a;
+			ScopedLock ml(&w->m);
+			w->done = true;
+			VERIFY(pthread_cond_signal(&w->c) == 0);
+		}
+	} w;
+	VERIFY(pthread_mutex_init(&w.m, 0) == 0);
+	VERIFY(pthread_cond_init(&w.c, 0) == 0);
+	w.done = false;
+	t.start(&waiter::wake, &w);
+	{
+		ScopedLock ml(&w.m);
+		while (!w.done)
+			VERIFY(pthread_cond_wait(&w.c, &w.m) == 0);
+	}
+	VERIFY(pthread_cond_destroy(&w.c) == 0);
+	VERIFY(pthread_mutex_destroy(&w.m) == 0);
+	return t.result();
+}
+
+#endif // __cpp_impl_coroutine
+
+#endif
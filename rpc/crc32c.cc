@@ -0,0 +1,195 @@
+#include "crc32c.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// reflected Castagnoli polynomial
+static const uint32_t POLY = 0x82f63b78;
+
+// a * b modulo POLY, both reflected polynomials
+static uint32_t
+multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m = 1u << 31, p = 0;
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = b & 1 ? (b >> 1) ^ POLY : b >> 1;
+	}
+	return p;
+}
+
+// streams of the hardware path: 3 of LONG bytes, then 3 of SHORT
+enum {
+	CRC_LONG = 8192,
+	CRC_SHORT = 256,
+};
+
+struct crc_tables {
+	uint32_t slice[8][256];
+	uint32_t x2n[32];       // x^(2^n) mod POLY
+	uint32_t long1, long2;  // x^(8 * CRC_LONG), x^(16 * CRC_LONG)
+	uint32_t short1, short2;
+	bool hw;
+
+	// x^(n * 2^k) mod POLY
+	uint32_t x2nmodp(size_t n, unsigned k) {
+		uint32_t p = 1u << 31;  // x^0
+		while (n) {
+			if (n & 1)
+				p = multmodp(x2n[k & 31], p);
+			n >>= 1;
+			k++;
+		}
+		return p;
+	}
+
+	crc_tables() {
+		for (unsigned n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++)
+				c = c & 1 ? (c >> 1) ^ POLY : c >> 1;
+			slice[0][n] = c;
+		}
+		for (unsigned n = 0; n < 256; n++)
+			for (int k = 1; k < 8; k++)
+				slice[k][n] = (slice[k - 1][n] >> 8) ^ slice[0][slice[k - 1][n] & 0xff];
+
+		x2n[0] = 1u << 30;  // x^1
+		for (int i = 1; i < 32; i++)
+			x2n[i] = multmodp(x2n[i - 1], x2n[i - 1]);
+		long1 = x2nmodp(CRC_LONG, 3);
+		long2 = x2nmodp(2 * CRC_LONG, 3);
+		short1 = x2nmodp(CRC_SHORT, 3);
+		short2 = x2nmodp(2 * CRC_SHORT, 3);
+
+#if defined(__x86_64__)
+		hw = __builtin_cpu_supports("sse4.2");
+#else
+		hw = false;
+#endif
+	}
+};
+
+// function-local so it is built before any static initializer uses it
+static crc_tables &
+tables()
+{
+	static crc_tables t;
+	return t;
+}
+
+// on the raw (un-inverted) register
+static uint32_t
+crc_sw(uint32_t c, const unsigned char *p, size_t len)
+{
+	const crc_tables &t = tables();
+	while (len && ((uintptr_t) p & 7)) {
+		c = (c >> 8) ^ t.slice[0][(c ^ *p++) & 0xff];
+		len--;
+	}
+	while (len >= 8) {
+		uint64_t w;
+		__builtin_memcpy(&w, p, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		w = __builtin_bswap64(w);
+#endif
+		uint32_t lo = (uint32_t) w ^ c, hi = (uint32_t) (w >> 32);
+		c = t.slice[7][lo & 0xff] ^ t.slice[6][(lo >> 8) & 0xff] ^
+			t.slice[5][(lo >> 16) & 0xff] ^ t.slice[4][lo >> 24] ^
+			t.slice[3][hi & 0xff] ^ t.slice[2][(hi >> 8) & 0xff] ^
+			t.slice[1][(hi >> 16) & 0xff] ^ t.slice[0][hi >> 24];
+		p += 8;
+		len -= 8;
+	}
+	while (len--)
+		c = (c >> 8) ^ t.slice[0][(c ^ *p++) & 0xff];
+	return c;
+}
+
+#if defined(__x86_64__)
+// three streams of n bytes (a multiple of 8) each, joined into one
+__attribute__((target("sse4.2"))) static uint32_t
+crc_hw3(uint32_t c, const unsigned char *p, size_t n, uint32_t x1, uint32_t x2)
+{
+	uint64_t c0 = c, c1 = 0, c2 = 0;
+	const unsigned char *end = p + n;
+	while (p < end) {
+		uint64_t w0, w1, w2;
+		__builtin_memcpy(&w0, p, 8);
+		__builtin_memcpy(&w1, p + n, 8);
+		__builtin_memcpy(&w2, p + 2 * n, 8);
+		c0 = _mm_crc32_u64(c0, w0);
+		c1 = _mm_crc32_u64(c1, w1);
+		c2 = _mm_crc32_u64(c2, w2);
+		p += 8;
+	}
+	return multmodp(x2, (uint32_t) c0) ^ multmodp(x1, (uint32_t) c1) ^ (uint32_t) c2;
+}
+
+__attribute__((target("sse4.2"))) static uint32_t
+crc_hw(uint32_t c, const unsigned char *p, size_t len)
+{
+	const crc_tables &t = tables();
+	while (len && ((uintptr_t) p & 7)) {
+		c = _mm_crc32_u8(c, *p++);
+		len--;
+	}
+	while (len >= 3 * CRC_LONG) {
+		c = crc_hw3(c, p, CRC_LONG, t.long1, t.long2);
+		p += 3 * CRC_LONG;
+		len -= 3 * CRC_LONG;
+	}
+	while (len >= 3 * CRC_SHORT) {
+		c = crc_hw3(c, p, CRC_SHORT, t.short1, t.short2);
+		p += 3 * CRC_SHORT;
+		len -= 3 * CRC_SHORT;
+	}
+	uint64_t c64 = c;
+	while (len >= 8) {
+		uint64_t w;
+		__builtin_memcpy(&w, p, 8);
+		c64 = _mm_crc32_u64(c64, w);
+		p += 8;
+		len -= 8;
+	}
+	c = (uint32_t) c64;
+	while (len--)
+		c = _mm_crc32_u8(c, *p++);
+	return c;
+}
+#endif
+
+uint32_t
+crc32c(uint32_t crc, const void *buf, size_t len)
+{
+	const unsigned char *p = (const unsigned char *) buf;
+#if defined(__x86_64__)
+	if (tables().hw)
+		return ~crc_hw(~crc, p, len);
+#endif
+	return ~crc_sw(~crc, p, len);
+}
+
+uint32_t
+crc32c_sw(uint32_t crc, const void *buf, size_t len)
+{
+	return ~crc_sw(~crc, (const unsigned char *) buf, len);
+}
+
+uint32_t
+crc32c_combine(uint32_t crc1, uint32_t crc2, size_t len2)
+{
+	return multmodp(tables().x2nmodp(len2, 3), crc1) ^ crc2;
+}
+
+const char *
+crc32c_impl()
+{
+	return tables().hw ? "sse4.2" : "sw";
+}
@@ -0,0 +1,27 @@
+#ifndef crc32c_h
+#define crc32c_h
+
+// CRC-32C (Castagnoli), the RPC_CHECKSUMMING checksum.
+//
+// crc32c() uses the SSE4.2 crc32 instruction when the CPU has it,
+// running three independent streams over long buffers so the
+// instruction's latency is hidden, and slicing-by-8 tables otherwise.
+// both give the same result.
+//
+// crcs chain: crc32c(crc32c(0, a, n), b, m) is the crc of a then b, and
+// crc32c_combine() joins the crcs of two pieces computed separately.
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint32_t crc32c(uint32_t crc, const void *buf, size_t len);
+
+// the crc of A then B, from crc1 = crc(A), crc2 = crc(B), len2 = |B|
+uint32_t crc32c_combine(uint32_t crc1, uint32_t crc2, size_t len2);
+
+// "sse4.2" or "sw", for benchmarks and logs
+const char *crc32c_impl();
+// the slicing-by-8 path regardless of the CPU, for benchmarks
+uint32_t crc32c_sw(uint32_t crc, const void *buf, size_t len);
+
+#endif
@@ -0,0 +1,78 @@
+// checksum benchmark: what RPC_CHECKSUMMING costs per GB of PDUs, for
+// the crc32c() in use and the slicing-by-8 fallback, next to memcpy of
+// the same buffers for scale.
+//
+// usage: crcbench [megabytes-per-run] [pdu-size ...]
+// prints one line per implementation and size:
+//   impl bytes GB/s ms-per-GB
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "crc32c.h"
+
+static uint64_t
+now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+enum { HW, SW, COPY };
+
+static void
+run(int impl, int sz, size_t total)
+{
+	std::vector<char> buf(sz), dst(sz);
+	for (int i = 0; i < sz; i++)
+		buf[i] = (char) (i * 131);
+	size_t n = total / sz;
+	uint32_t c = 0;
+
+	uint64_t start = now_ns();
+	for (size_t i = 0; i < n; i++) {
+		if (impl == HW)
+			c ^= crc32c(0, &buf[0], sz);
+		else if (impl == SW)
+			c ^= crc32c_sw(0, &buf[0], sz);
+		else {
+			memcpy(&dst[0], &buf[0], sz);
+			c ^= dst[i % sz];
+		}
+	}
+	double secs = (now_ns() - start) / 1e9;
+	double gb = (double) n * sz / 1e9;
+
+	const char *name = impl == HW ? crc32c_impl() : impl == SW ? "slice8" : "memcpy";
+	printf("%s %d %.2f %.1f\n", name, sz, gb / secs, secs / gb * 1000);
+	// keep the loop's results alive
+	if (c == 0x12345678)
+		printf("\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t mb = argc > 1 ? atoi(argv[1]) : 1000;
+	std::vector<int> sizes;
+	for (int i = 2; i < argc; i++)
+		sizes.push_back(atoi(argv[i]));
+	if (sizes.empty()) {
+		sizes.push_back(64);
+		sizes.push_back(4096);
+		sizes.push_back(65536);
+		sizes.push_back(1 << 20);
+	}
+
+	printf("# impl bytes GB/s ms-per-GB\n");
+	for (unsigned i = 0; i < sizes.size(); i++) {
+		run(HW, sizes[i], mb << 20);
+		run(SW, sizes[i], mb << 20);
+		run(COPY, sizes[i], mb << 20);
+	}
+	return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef deadline_h
+#define deadline_h
+
+// the deadline of the RPC a handler thread is serving.
+//
+// rpcc sends the time its caller will still wait (req_header::
+// deadline_ms) on connections that agreed to the compact header, so
+// peers speaking the fixed layout see no deadline; rpcs drops requests
+// that expire while queued, and sets the deadline for the handler's
+// thread while it runs. a long handler can poll rpc_deadline_expired()
+// and give up with rpc_const::deadline_failure, freeing its ThrPool
+// thread for work whose caller is still there.
+
+#include <time.h>
+
+// true once the current RPC's caller has stopped waiting; false when
+// there is no deadline, or outside a handler
+bool rpc_deadline_expired();
+
+// ms left before the current RPC's deadline (at least 0), or -1 if
+// there is none
+int rpc_deadline_remaining_ms();
+
+// sets the calling thread's deadline (CLOCK_MONOTONIC, tv_sec 0 for
+// none) for the lifetime of the scope; dispatch() wraps handlers in one
+class rpc_deadline_scope {
+	public:
+		rpc_deadline_scope(const struct timespec &d);
+		~rpc_deadline_scope();
+	private:
+		const struct timespec *saved_;
+};
+
+#endif
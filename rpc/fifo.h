@@ -3,6 +3,7 @@
 
 // fifo template
 // blocks enq() and deq() when queue is FULL or EMPTY
+// see mpmc_fifo.h for a bounded lock-free version with the same interface
 
 #include <errno.h>
 #include <list>
@@ -19,7 +20,7 @@ class fifo {
 		~fifo();
 		bool enq(T, bool blocking=true);
 		void deq(T *);
-		bool size();
+		unsigned int size();
 
 	private:
 		std::list<T> q_;
@@ -46,7 +47,7 @@ fifo<T>::~fifo()
 	VERIFY(pthread_cond_destroy(&has_space_c_) == 0);
 }
 
-template<class T> bool
+template<class T> unsigned int
 fifo<T>::size()
 {
 	ScopedLock ml(&m_);
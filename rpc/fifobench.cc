@@ -0,0 +1,77 @@
+// fifo benchmark: fifo<T> (list + mutex + condvars) against mpmc_fifo<T>
+// with equal numbers of producers and consumers passing pointers.
+//
+// usage: fifobench [items-per-producer] [capacity]
+// prints one line per queue and thread count:
+//   queue producers consumers items kops/s
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <vector>
+
+#include "fifo.h"
+#include "mpmc_fifo.h"
+#include "method_thread.h"
+
+template<class Q>
+class bench {
+	public:
+		bench(int cap, int n) : q_(cap), n_(n) { }
+
+		void producer() {
+			for (long i = 1; i <= n_; i++)
+				q_.enq((void *) i);
+		}
+
+		// runs until it dequeues a NULL
+		void consumer() {
+			void *e;
+			do {
+				q_.deq(&e);
+			} while (e);
+		}
+
+		Q q_;
+		int n_;
+};
+
+template<class Q> static void
+run(const char *name, int nthreads, int cap, int n)
+{
+	bench<Q> b(cap, n);
+	std::vector<pthread_t> prod, cons;
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	for (int i = 0; i < nthreads; i++)
+		cons.push_back(method_thread(&b, false, &bench<Q>::consumer));
+	for (int i = 0; i < nthreads; i++)
+		prod.push_back(method_thread(&b, false, &bench<Q>::producer));
+	for (int i = 0; i < nthreads; i++)
+		VERIFY(pthread_join(prod[i], NULL) == 0);
+	for (int i = 0; i < nthreads; i++)
+		b.q_.enq(NULL);
+	for (int i = 0; i < nthreads; i++)
+		VERIFY(pthread_join(cons[i], NULL) == 0);
+	gettimeofday(&end, NULL);
+
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	unsigned long long items = (unsigned long long) nthreads * n;
+	printf("%s %d %d %llu %.1f\n", name, nthreads, nthreads, items, items / secs / 1000);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int n = argc > 1 ? atoi(argv[1]) : 200000;
+	int cap = argc > 2 ? atoi(argv[2]) : 1024;
+	int threads[] = { 1, 2, 4, 8, 16, 32 };
+
+	printf("# queue producers consumers items kops/s (capacity %d)\n", cap);
+	for (unsigned i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+		run<fifo<void *> >("fifo", threads[i], cap, n);
+		run<mpmc_fifo<void *> >("mpmc_fifo", threads[i], cap, n);
+	}
+	return 0;
+}
@@ -9,17 +9,20 @@ enum dbcode {
 	JSL_DBG_4 = 4, // Debugging
 };
 
+#include "trace.h"
+
 extern int JSL_DEBUG_LEVEL;
 
+// printed at once up to JSL_DEBUG_LEVEL, as always, and recorded in
+// the trace rings up to their own level; see trace.h
 #define jsl_log(level,...)                                    \
 	do {                                                        \
-		if(JSL_DEBUG_LEVEL < abs(level))			      							\
-		{;}                                                       \
-		else {                                                    \
-			{ printf(__VA_ARGS__);}														\
-		}                                                         \
+		if(JSL_DEBUG_LEVEL >= abs(level))                         \
+			printf(__VA_ARGS__);                                    \
+		trace_log(abs(level), __VA_ARGS__);                       \
 	} while(0)
 
+// also sets trace_level
 void jsl_set_debug(int level);
 
 #endif // __JSL_LOG_H__
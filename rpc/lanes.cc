@@ -0,0 +1,302 @@
+#include <stdio.h>
+#include <algorithm>
+
+#include "lanes.h"
+#include "slock.h"
+#include "stats.h"
+
+static stat_counter lane_rejects("rpcs.lane_rejects");
+static stat_counter client_rejects("rpcs.client_rejects");
+
+// stride of a lane of weight 1
+static const uint64_t STRIDE1 = 1 << 20;
+
+static uint64_t
+age_ns(const struct timespec &a, const struct timespec &now)
+{
+	int64_t d = (int64_t) (now.tv_sec - a.tv_sec) * 1000000000 +
+		(now.tv_nsec - a.tv_nsec);
+	return d > 0 ? d : 0;
+}
+
+dispatch_lanes::dispatch_lanes() : vtime_(0), cap_(0), owed_(0)
+{
+	VERIFY(pthread_mutex_init(&m_, 0) == 0);
+	static const unsigned int weights[LANE_COUNT] = { 8, 4, 1 };
+	for (int i = 0; i < LANE_COUNT; i++) {
+		lanes_[i].n = 0;
+		lanes_[i].stride = STRIDE1 / weights[i];
+		lanes_[i].pass = 0;
+		lanes_[i].max_wait_ns = (uint64_t) LANE_MAX_WAIT_MS * 1000000;
+	}
+}
+
+dispatch_lanes::~dispatch_lanes()
+{
+	VERIFY(pthread_mutex_destroy(&m_) == 0);
+}
+
+void
+dispatch_lanes::set_weight(int l, unsigned int w)
+{
+	VERIFY(l >= 0 && l < LANE_COUNT && w > 0);
+	ScopedLock ml(&m_);
+	lanes_[l].stride = STRIDE1 / w;
+}
+
+void
+dispatch_lanes::set_max_wait(int l, int ms)
+{
+	VERIFY(l >= 0 && l < LANE_COUNT && ms > 0);
+	ScopedLock ml(&m_);
+	lanes_[l].max_wait_ns = (uint64_t) ms * 1000000;
+}
+
+void
+dispatch_lanes::set_client_cap(int n)
+{
+	VERIFY(n >= 0);
+	ScopedLock ml(&m_);
+	cap_ = n;
+}
+
+// forget clients with nothing queued, once there are too many
+void
+dispatch_lanes::sweep(lane &ln)
+{
+	std::unordered_map<unsigned int, client>::iterator i = ln.clients.begin();
+	while (i != ln.clients.end()) {
+		if (!i->second.active)
+			i = ln.clients.erase(i);
+		else
+			++i;
+	}
+}
+
+bool
+dispatch_lanes::admit(int l, unsigned int clt, void *job, int sz,
+		const struct timespec &arrive)
+{
+	VERIFY(l >= 0 && l < LANE_COUNT);
+	ScopedLock ml(&m_);
+	lane &ln = lanes_[l];
+	if (ln.n >= LANE_MAX_QUEUED) {
+		lane_rejects.add();
+		return false;
+	}
+	if (ln.clients.size() >= LANE_MAX_CLIENTS && !ln.clients.count(clt))
+		sweep(ln);
+	client &c = ln.clients[clt];
+	// c.q is in arrival order, so its front is the longest waiting
+	if (c.q.size() >= LANE_CLIENT_QUEUED ||
+			(!c.q.empty() && age_ns(c.q.front().arrive, arrive) > ln.max_wait_ns)) {
+		client_rejects.add();
+		return false;
+	}
+	if (!ln.n && ln.pass < vtime_) {
+		// an idle lane doesn't bank the turns it didn't use
+		ln.pass = vtime_;
+	}
+	item it = { job, sz + LANE_REQ_COST, arrive };
+	c.q.push_back(it);
+	ln.n++;
+	if (!c.active) {
+		c.active = true;
+		ln.rr.push_back(clt);
+	}
+	return true;
+}
+
+bool
+dispatch_lanes::capped(unsigned int clt)
+{
+	if (!cap_)
+		return false;
+	std::unordered_map<unsigned int, int>::iterator f = inflight_.find(clt);
+	return f != inflight_.end() && f->second >= cap_;
+}
+
+// a whole round went by without any client affording its next job,
+// e.g. all of them are large: give every client that may run the
+// rounds of quanta the nearest one still lacks, all at once, rather
+// than going round the clients once per LANE_QUANTUM
+void
+dispatch_lanes::skip_rounds(lane &ln)
+{
+	int64_t rounds = -1;
+	for (unsigned i = 0; i < ln.rr.size(); i++) {
+		if (capped(ln.rr[i]))
+			continue;
+		client &c = ln.clients[ln.rr[i]];
+		int64_t need = c.q.front().cost - c.deficit;
+		int64_t r = need > 0 ? (need + LANE_QUANTUM - 1) / LANE_QUANTUM : 0;
+		if (rounds < 0 || r < rounds)
+			rounds = r;
+	}
+	if (rounds <= 0)
+		return;
+	for (unsigned i = 0; i < ln.rr.size(); i++)
+		if (!capped(ln.rr[i]))
+			ln.clients[ln.rr[i]].deficit += rounds * LANE_QUANTUM;
+}
+
+// deficit round robin over ln's clients, skipping those at the cap
+bool
+dispatch_lanes::pick(lane &ln, item *it, unsigned int *clt)
+{
+	unsigned int skipped = 0;  // capped clients in a row
+	unsigned int topped = 0;   // clients topped up since one was served
+	while (skipped < ln.rr.size()) {
+		unsigned int id = ln.rr.front();
+		if (capped(id)) {
+			ln.rr.pop_front();
+			ln.rr.push_back(id);
+			skipped++;
+			continue;
+		}
+		client &c = ln.clients[id];
+		if (c.deficit < c.q.front().cost) {
+			// its turn is over: top up and go to the back
+			c.deficit += LANE_QUANTUM;
+			ln.rr.pop_front();
+			ln.rr.push_back(id);
+			skipped = 0;
+			if (++topped >= ln.rr.size()) {
+				skip_rounds(ln);
+				topped = 0;
+			}
+			continue;
+		}
+		*it = c.q.front();
+		*clt = id;
+		c.q.pop_front();
+		c.deficit -= it->cost;
+		if (c.q.empty()) {
+			c.deficit = 0;
+			c.active = false;
+			ln.rr.pop_front();
+		}
+		return true;
+	}
+	return false;
+}
+
+void *
+dispatch_lanes::next_locked(unsigned int *clt)
+{
+	bool tried[LANE_COUNT] = { false };
+	for (;;) {
+		lane *best = NULL;
+		for (int i = 0; i < LANE_COUNT; i++) {
+			if (!tried[i] && lanes_[i].n &&
+					(!best || lanes_[i].pass < best->pass))
+				best = &lanes_[i];
+		}
+		if (!best)
+			return NULL;
+		tried[best - lanes_] = true;
+
+		item it;
+		if (!pick(*best, &it, clt))
+			continue;  // every client with work is at its cap
+
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		uint64_t w = age_ns(it.arrive, now);
+		client &c = best->clients[*clt];
+		c.served++;
+		c.wait_ns += w;
+		if (w > c.max_wait_ns)
+			c.max_wait_ns = w;
+		best->n--;
+		vtime_ = best->pass;
+		best->pass += best->stride;
+		inflight_[*clt]++;
+		return it.job;
+	}
+}
+
+void *
+dispatch_lanes::next(unsigned int *clt)
+{
+	ScopedLock ml(&m_);
+	void *j = next_locked(clt);
+	if (!j)
+		owed_++;
+	return j;
+}
+
+void *
+dispatch_lanes::done(unsigned int clt, unsigned int *nclt)
+{
+	ScopedLock ml(&m_);
+	std::unordered_map<unsigned int, int>::iterator i = inflight_.find(clt);
+	VERIFY(i != inflight_.end());
+	if (--i->second == 0)
+		inflight_.erase(i);
+	if (!owed_)
+		return NULL;
+	void *j = next_locked(nclt);
+	if (j)
+		owed_--;
+	return j;
+}
+
+bool
+dispatch_lanes::withdraw(int l, unsigned int clt, void *job)
+{
+	VERIFY(l >= 0 && l < LANE_COUNT);
+	ScopedLock ml(&m_);
+	lane &ln = lanes_[l];
+	std::unordered_map<unsigned int, client>::iterator i = ln.clients.find(clt);
+	if (i == ln.clients.end())
+		return false;
+	client &c = i->second;
+	// most likely the last one admitted
+	for (std::deque<item>::reverse_iterator k = c.q.rbegin(); k != c.q.rend(); ++k) {
+		if (k->job != job)
+			continue;
+		c.q.erase(--k.base());
+		ln.n--;
+		if (c.q.empty()) {
+			c.deficit = 0;
+			c.active = false;
+			ln.rr.erase(std::find(ln.rr.begin(), ln.rr.end(), clt));
+		}
+		return true;
+	}
+	return false;
+}
+
+unsigned int
+dispatch_lanes::queued(int l)
+{
+	ScopedLock ml(&m_);
+	return lanes_[l].n;
+}
+
+std::string
+dispatch_lanes::report()
+{
+	static const char *names[LANE_COUNT] = { "high", "normal", "bulk" };
+	std::string r;
+	char line[256];
+	ScopedLock ml(&m_);
+	for (int l = 0; l < LANE_COUNT; l++) {
+		std::unordered_map<unsigned int, client>::iterator i;
+		for (i = lanes_[l].clients.begin(); i != lanes_[l].clients.end(); ++i) {
+			client &c = i->second;
+			std::unordered_map<unsigned int, int>::iterator f = inflight_.find(i->first);
+			snprintf(line, sizeof(line),
+					"lane.%s.client.%u queued=%u running=%d served=%llu "
+					"wait_mean_us=%llu wait_max_us=%llu\n",
+					names[l], i->first, (unsigned) c.q.size(),
+					f == inflight_.end() ? 0 : f->second,
+					(unsigned long long) c.served,
+					(unsigned long long) (c.served ? c.wait_ns / c.served / 1000 : 0),
+					(unsigned long long) (c.max_wait_ns / 1000));
+			r += line;
+		}
+	}
+	return r;
+}
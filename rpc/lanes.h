@@ -0,0 +1,120 @@
+#ifndef lanes_h
+#define lanes_h
+
+// rpcs dispatch queues: one per priority lane, served by stride
+// scheduling so that each backlogged lane gets pool threads in
+// proportion to its weight. a burst of bulk requests then only delays
+// a high-priority one by the bulk requests already running, not by
+// every one queued.
+//
+// within a lane each client (clt_nonce) has its own queue, and the
+// clients with work are served deficit round robin, charged by request
+// bytes plus LANE_REQ_COST, so a client flooding the server only ever
+// gets its share of the threads. optionally a client may also be
+// capped at some number of requests running at once.
+//
+// admit() is the admission control: a request is turned away at once
+// (rpcs replies rpc_const::overload_failure) when its lane is full,
+// when its client already has LANE_CLIENT_QUEUED requests waiting, or
+// when its client is backed up: the client's oldest queued request has
+// waited longer than the lane's bound. the age is taken at admission,
+// so it grows even while every pool thread is stuck, and a client with
+// nothing queued is never refused for the others' backlog.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <deque>
+#include <string>
+#include <unordered_map>
+
+enum rpc_lane {
+	LANE_HIGH,    // small, latency-sensitive: getattr, lock acquire
+	LANE_NORMAL,  // the default
+	LANE_BULK,    // large transfers
+	LANE_COUNT,
+};
+
+enum {
+	// at most LANE_COUNT * LANE_MAX_QUEUED jobs are queued, which
+	// must stay below the dispatch pool's queue limit
+	LANE_MAX_QUEUED = 128,
+	LANE_CLIENT_QUEUED = 32,
+	LANE_MAX_WAIT_MS = 100,
+	LANE_QUANTUM = 4096,   // bytes of credit per round robin turn
+	LANE_REQ_COST = 512,   // charged per request on top of its bytes
+	LANE_MAX_CLIENTS = 1024,  // idle clients kept for reporting
+};
+
+class dispatch_lanes {
+	public:
+		dispatch_lanes();
+		~dispatch_lanes();
+
+		// weights default to 8, 4 and 1
+		void set_weight(int lane, unsigned int w);
+		void set_max_wait(int lane, int ms);
+		// requests of one client running at once; 0 (the default) for
+		// no limit
+		void set_client_cap(int n);
+
+		// queue job, sz bytes from client clt, on lane; it arrived at
+		// arrive (CLOCK_MONOTONIC). false if it is turned away.
+		bool admit(int lane, unsigned int clt, void *job, int sz,
+				const struct timespec &arrive);
+		// the next job to run, and its client; NULL if there is nothing
+		// that may run now
+		void *next(unsigned int *clt);
+		// a job of clt's from next() has finished. returns another job
+		// to run in its place if one was held back by the client cap
+		// while pool threads went idle, else NULL.
+		void *done(unsigned int clt, unsigned int *nclt);
+		// take job, admitted for clt on lane, back out of the queue;
+		// false if next() has already handed it out
+		bool withdraw(int lane, unsigned int clt, void *job);
+
+		unsigned int queued(int lane);
+		// one line per client: queued and running requests, requests
+		// served, and mean and max queue wait
+		std::string report();
+
+	private:
+		struct item {
+			void *job;
+			int cost;
+			struct timespec arrive;
+		};
+		struct client {
+			client() : deficit(0), active(false), served(0), wait_ns(0),
+				max_wait_ns(0) { }
+			std::deque<item> q;
+			int64_t deficit;
+			bool active;       // on its lane's round robin
+			uint64_t served;
+			uint64_t wait_ns;  // total, for the mean
+			uint64_t max_wait_ns;
+		};
+		struct lane {
+			std::unordered_map<unsigned int, client> clients;
+			std::deque<unsigned int> rr;  // clients with queued jobs
+			unsigned int n;               // jobs queued
+			uint64_t stride;              // STRIDE1 / weight
+			uint64_t pass;                // virtual time of the next job
+			uint64_t max_wait_ns;
+		};
+
+		pthread_mutex_t m_;
+		lane lanes_[LANE_COUNT];
+		uint64_t vtime_;  // pass of the last job handed out
+		int cap_;
+		std::unordered_map<unsigned int, int> inflight_;  // running, by client
+		int owed_;        // next() calls that found only capped clients
+
+		bool pick(lane &ln, item *it, unsigned int *clt);
+		bool capped(unsigned int clt);
+		void skip_rounds(lane &ln);
+		void *next_locked(unsigned int *clt);
+		void sweep(lane &ln);
+};
+
+#endif
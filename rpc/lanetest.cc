@@ -0,0 +1,196 @@
+// dispatch_lanes (lanes.h) tests: deficit round robin between clients,
+// the per-client cap, and admission control. no rpcs; jobs are just
+// numbers, and arrival times are made up.
+// usage: lanetest
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "lanes.h"
+#include "lang/verify.h"
+
+static struct timespec
+at_ms(int ms)
+{
+	struct timespec t;
+	t.tv_sec = 1000 + ms / 1000;
+	t.tv_nsec = (ms % 1000) * 1000000L;
+	return t;
+}
+
+static void *
+job(unsigned int clt, int i)
+{
+	return (void *) (uintptr_t) (clt * 1000 + i + 1);
+}
+
+static unsigned int
+client_of(void *j)
+{
+	return ((uintptr_t) j - 1) / 1000;
+}
+
+// a client with a deep queue doesn't hold back one with a short queue:
+// each gets about LANE_QUANTUM bytes per turn
+void
+drr_tests()
+{
+	printf("drr_tests\n");
+	dispatch_lanes l;
+	const int sz = 100;  // LANE_QUANTUM / (sz + LANE_REQ_COST) = 6 per turn
+	for (int i = 0; i < 30; i++)
+		VERIFY(l.admit(LANE_NORMAL, 1, job(1, i), sz, at_ms(0)));
+	for (int i = 0; i < 5; i++)
+		VERIFY(l.admit(LANE_NORMAL, 2, job(2, i), sz, at_ms(1)));
+	VERIFY(l.queued(LANE_NORMAL) == 35);
+
+	int served[3] = { 0, 0, 0 };
+	int turn = LANE_QUANTUM / (sz + LANE_REQ_COST) + 1;
+	for (int i = 0; i < 2 * turn; i++) {
+		unsigned int clt;
+		void *j = l.next(&clt);
+		VERIFY(j && client_of(j) == clt);
+		served[clt]++;
+		VERIFY(l.done(clt, &clt) == NULL);
+	}
+	// client 2 was done within the first two turns despite arriving
+	// behind 30 of client 1's
+	VERIFY(served[2] == 5);
+	VERIFY(served[1] == 2 * turn - 5);
+
+	// and jobs of one client stay in order
+	unsigned int clt;
+	void *j, *last = NULL;
+	while ((j = l.next(&clt)) != NULL) {
+		VERIFY(clt == 1 && j > last);
+		last = j;
+		l.done(clt, &clt);
+	}
+	VERIFY(l.queued(LANE_NORMAL) == 0);
+
+	// requests of many quanta each are still shared out evenly; the
+	// credit for them comes in one go, not a round per quantum
+	for (int i = 0; i < 3; i++) {
+		VERIFY(l.admit(LANE_NORMAL, 1, job(1, i), 1 << 20, at_ms(2)));
+		VERIFY(l.admit(LANE_NORMAL, 2, job(2, i), 1 << 20, at_ms(2)));
+	}
+	// the idle next() that ended the loop above is owed a job, so each
+	// done() here hands over the next one
+	served[1] = served[2] = 0;
+	j = l.next(&clt);
+	for (int i = 0; i < 6; i++) {
+		VERIFY(j != NULL);
+		served[clt]++;
+		if (i % 2)
+			VERIFY(served[1] == served[2]);
+		if ((j = l.done(clt, &clt)) == NULL)
+			j = l.next(&clt);
+	}
+	VERIFY(j == NULL);
+	printf(" -- drr OK\n");
+}
+
+// with a cap of one, a client's second job waits for its first, and
+// the thread that finishes the first picks it up
+void
+cap_tests()
+{
+	printf("cap_tests\n");
+	dispatch_lanes l;
+	l.set_client_cap(1);
+	for (int i = 0; i < 2; i++) {
+		VERIFY(l.admit(LANE_NORMAL, 1, job(1, i), 10, at_ms(0)));
+		VERIFY(l.admit(LANE_NORMAL, 2, job(2, i), 10, at_ms(0)));
+	}
+
+	unsigned int c1, c2, c3;
+	void *j1 = l.next(&c1);
+	void *j2 = l.next(&c2);
+	VERIFY(j1 && j2 && c1 != c2);
+	// both clients are at the cap: nothing may run
+	VERIFY(l.next(&c3) == NULL);
+	VERIFY(l.queued(LANE_NORMAL) == 2);
+
+	// the idle next() above is owed a job; done() hands it over
+	void *j3 = l.done(c1, &c3);
+	VERIFY(j3 && c3 == c1 && j3 == job(c1, 1));
+	VERIFY(l.done(c2, &c3) == NULL);
+	VERIFY(l.next(&c3) == job(c2, 1));
+	VERIFY(l.next(&c3) == NULL);
+	printf(" -- cap OK\n");
+}
+
+void
+admission_tests()
+{
+	printf("admission_tests\n");
+	dispatch_lanes l;
+	l.set_max_wait(LANE_NORMAL, 50);
+
+	// nothing is handed out, as when every pool thread is stuck, yet
+	// client 1's oldest request ages past the bound and it is refused
+	VERIFY(l.admit(LANE_NORMAL, 1, job(1, 0), 10, at_ms(0)));
+	VERIFY(l.admit(LANE_NORMAL, 1, job(1, 1), 10, at_ms(40)));
+	VERIFY(!l.admit(LANE_NORMAL, 1, job(1, 2), 10, at_ms(60)));
+	// a quiet client still gets in, and isn't refused for its own
+	// fresh request
+	VERIFY(l.admit(LANE_NORMAL, 2, job(2, 0), 10, at_ms(60)));
+	VERIFY(l.admit(LANE_NORMAL, 2, job(2, 1), 10, at_ms(70)));
+	// nor is a client on another lane
+	VERIFY(l.admit(LANE_HIGH, 1, job(1, 900), 10, at_ms(60)));
+
+	// once client 1's queue drains it is admitted again
+	unsigned int clt;
+	void *j;
+	while ((j = l.next(&clt)) != NULL)
+		l.done(clt, &clt);
+	VERIFY(l.admit(LANE_NORMAL, 1, job(1, 0), 10, at_ms(200)));
+
+	// a client's queue is bounded however fresh it is
+	int i;
+	for (i = 1; i < LANE_CLIENT_QUEUED; i++)
+		VERIFY(l.admit(LANE_NORMAL, 1, job(1, i), 10, at_ms(200)));
+	VERIFY(!l.admit(LANE_NORMAL, 1, job(1, i), 10, at_ms(200)));
+
+	// the lane as a whole is bounded too
+	dispatch_lanes full;
+	for (i = 0; i < LANE_MAX_QUEUED; i++)
+		VERIFY(full.admit(LANE_BULK, i, job(i, 0), 10, at_ms(0)));
+	VERIFY(!full.admit(LANE_BULK, i, job(i, 0), 10, at_ms(0)));
+	VERIFY(full.admit(LANE_NORMAL, i, job(i, 0), 10, at_ms(0)));
+	printf(" -- admission OK\n");
+}
+
+// a job taken back before it ran leaves the lane as if never admitted
+void
+withdraw_tests()
+{
+	printf("withdraw_tests\n");
+	dispatch_lanes l;
+	VERIFY(l.admit(LANE_NORMAL, 1, job(1, 0), 10, at_ms(0)));
+	VERIFY(l.admit(LANE_NORMAL, 2, job(2, 0), 10, at_ms(0)));
+	VERIFY(l.admit(LANE_NORMAL, 2, job(2, 1), 10, at_ms(0)));
+	VERIFY(l.withdraw(LANE_NORMAL, 2, job(2, 1)));
+	VERIFY(!l.withdraw(LANE_NORMAL, 2, job(2, 1)));
+	VERIFY(l.withdraw(LANE_NORMAL, 1, job(1, 0)));
+	VERIFY(l.queued(LANE_NORMAL) == 1);
+
+	unsigned int clt;
+	VERIFY(l.next(&clt) == job(2, 0) && clt == 2);
+	// handed out already
+	VERIFY(!l.withdraw(LANE_NORMAL, 2, job(2, 0)));
+	VERIFY(l.next(&clt) == NULL);
+	printf(" -- withdraw OK\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	drr_tests();
+	cap_tests();
+	admission_tests();
+	withdraw_tests();
+	printf("lanetest OK\n");
+	return 0;
+}
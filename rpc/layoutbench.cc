@@ -0,0 +1,161 @@
+// thread layout benchmark. a loop thread, started like a Reactor loop,
+// writes each request into a buffer and queues it on a ThrPool, whose
+// worker reads it back, as dispatch does with a PDU the loop has just
+// read. compares the worker on the loop's cpu (same), on another cpu
+// (cross) and both unpinned (float).
+//
+// usage: layoutbench [-n requests] [-b bytes] [-d depth] [-l name:spec]...
+// -l replaces the default layouts with RPC_THREAD_LAYOUT-style specs.
+// prints one line per layout:
+//   layout bytes reqs ns/req local%
+// local% is the share of jobs ThrPool gave to the worker on the
+// adding thread's cpu.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "thr_pool.h"
+#include "thread_layout.h"
+#include "method_thread.h"
+#include "stats.h"
+
+class bench {
+	public:
+		bench(int n, int bytes, int depth) : n_(n), bytes_(bytes), sum_(0) {
+			for (int i = 0; i < depth; i++) {
+				bufs_.push_back((uint64_t *) calloc(1, bytes));
+				VERIFY(bufs_.back());
+			}
+			busy_ = new int[depth]();
+			pool_ = new ThrPool(1);
+		}
+		~bench() {
+			delete pool_;
+			for (unsigned i = 0; i < bufs_.size(); i++)
+				free(bufs_[i]);
+			delete[] busy_;
+		}
+
+		// the reactor loop: fill a free buffer, hand it over
+		void loop() {
+			unsigned depth = bufs_.size();
+			int words = bytes_ / sizeof(uint64_t);
+			for (int i = 0; i < n_; i++) {
+				int slot = i % depth;
+				while (__atomic_load_n(&busy_[slot], __ATOMIC_ACQUIRE))
+					sched_yield();
+				uint64_t *b = bufs_[slot];
+				for (int k = 0; k < words; k++)
+					b[k] = i + k;
+				__atomic_store_n(&busy_[slot], 1, __ATOMIC_RELAXED);
+				pool_->addObjJob(this, &bench::handle, slot);
+			}
+			for (unsigned s = 0; s < depth; s++)
+				while (__atomic_load_n(&busy_[s], __ATOMIC_ACQUIRE))
+					sched_yield();
+		}
+
+		// the handler: read the whole request
+		void handle(int slot) {
+			uint64_t *b = bufs_[slot];
+			uint64_t s = 0;
+			for (int k = 0; k < (int) (bytes_ / sizeof(uint64_t)); k++)
+				s += b[k];
+			sum_ += s;
+			__atomic_store_n(&busy_[slot], 0, __ATOMIC_RELEASE);
+		}
+
+	private:
+		int n_;
+		int bytes_;
+		std::vector<uint64_t *> bufs_;
+		int *busy_;
+		ThrPool *pool_;
+		uint64_t sum_;
+};
+
+static void
+run(const char *name, const char *spec, int n, int bytes, int depth)
+{
+	if (!thread_layout_set(spec)) {
+		fprintf(stderr, "layoutbench: bad layout \"%s\"\n", spec);
+		exit(1);
+	}
+	unsigned long long local0 = stats_counter_value("thrpool.local");
+
+	// the pool's worker is placed as it starts
+	bench b(n, bytes, depth);
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	pthread_t th = method_thread(thread_layout_place(THR_ROLE_REACTOR, 0),
+			&b, false, &bench::loop);
+	VERIFY(pthread_join(th, NULL) == 0);
+	gettimeofday(&end, NULL);
+
+	double ns = ((end.tv_sec - start.tv_sec) * 1e9 +
+			(end.tv_usec - start.tv_usec) * 1e3) / n;
+	unsigned long long local = stats_counter_value("thrpool.local") - local0;
+	printf("%s %d %d %.0f %.1f\n", name, bytes, n, ns, 100.0 * local / n);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int n = 200000;
+	int bytes = 16384;
+	int depth = 4;
+	std::vector<std::string> layouts;
+	int ch;
+	while ((ch = getopt(argc, argv, "n:b:d:l:")) != -1) {
+		switch (ch) {
+		case 'n':
+			n = atoi(optarg);
+			break;
+		case 'b':
+			bytes = atoi(optarg);
+			break;
+		case 'd':
+			depth = atoi(optarg);
+			break;
+		case 'l':
+			if (!strchr(optarg, ':')) {
+				fprintf(stderr, "layoutbench: -l name:spec\n");
+				exit(1);
+			}
+			layouts.push_back(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n requests] [-b bytes] [-d depth]"
+					" [-l name:spec]...\n", argv[0]);
+			exit(1);
+		}
+	}
+	if (n <= 0 || bytes < (int) sizeof(uint64_t) || depth <= 0) {
+		fprintf(stderr, "layoutbench: bad -n, -b or -d\n");
+		exit(1);
+	}
+
+	if (layouts.empty()) {
+		layouts.push_back("same:reactor=0;worker=0");
+		if (sysconf(_SC_NPROCESSORS_ONLN) > 1)
+			layouts.push_back("cross:reactor=0;worker=1");
+		else
+			fprintf(stderr, "layoutbench: one cpu, skipping cross\n");
+		layouts.push_back("float:");
+	}
+
+	printf("# layout bytes reqs ns/req local%%\n");
+	for (unsigned i = 0; i < layouts.size(); i++) {
+		std::string name = layouts[i].substr(0, layouts[i].find(':'));
+		std::string spec = layouts[i].substr(layouts[i].find(':') + 1);
+		run(name.c_str(), spec.c_str(), n, bytes, depth);
+	}
+	return 0;
+}
@@ -0,0 +1,412 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+
+#include "localconn.h"
+#include "method_thread.h"
+#include "slab.h"
+#include "thread_layout.h"
+#include "slock.h"
+#include "jsl_log.h"
+
+#define MAX_PDU (10<<20) //maximum PDU is 10M
+
+static bool
+unix_addr(const char *path, struct sockaddr_un *sun)
+{
+	memset(sun, 0, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sun->sun_path))
+		return false;
+	strcpy(sun->sun_path, path);
+	return true;
+}
+
+int
+unix_listen(const char *path)
+{
+	struct sockaddr_un sun;
+	if (!unix_addr(path, &sun))
+		return -1;
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s < 0)
+		return -1;
+	unlink(path);
+	if (bind(s, (struct sockaddr *) &sun, sizeof(sun)) < 0 || listen(s, 1000) < 0) {
+		jsl_log(JSL_DBG_1, "unix_listen %s failed %d\n", path, errno);
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+int
+unix_connect(const char *path)
+{
+	struct sockaddr_un sun;
+	if (!unix_addr(path, &sun))
+		return -1;
+	int s = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (s < 0)
+		return -1;
+	if (connect(s, (struct sockaddr *) &sun, sizeof(sun)) < 0) {
+		jsl_log(JSL_DBG_1, "unix_connect %s failed %d\n", path, errno);
+		close(s);
+		return -1;
+	}
+	return s;
+}
+
+// the hello: one byte plus up to nfds descriptors
+static bool
+send_hello(int s, char mode, int *fds, int nfds)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	char cbuf[CMSG_SPACE(3 * sizeof(int))];
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &mode;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (nfds) {
+		memset(cbuf, 0, sizeof(cbuf));
+		msg.msg_control = cbuf;
+		msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+		struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+		cm->cmsg_level = SOL_SOCKET;
+		cm->cmsg_type = SCM_RIGHTS;
+		cm->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+		memcpy(CMSG_DATA(cm), fds, nfds * sizeof(int));
+	}
+	return sendmsg(s, &msg, 0) == 1;
+}
+
+static bool
+recv_hello(int s, char *mode, int *fds, int *nfds)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	char cbuf[CMSG_SPACE(3 * sizeof(int))];
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = mode;
+	iov.iov_len = 1;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+	*nfds = 0;
+	if (recvmsg(s, &msg, 0) != 1)
+		return false;
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+		if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+			*nfds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+			if (*nfds > 3)
+				*nfds = 3;
+			memcpy(fds, CMSG_DATA(cm), *nfds * sizeof(int));
+		}
+	}
+	return true;
+}
+
+connection *
+connect_to_local(const char *path, bool shm, chanmgr *mgr, int lossy)
+{
+	int s = unix_connect(path);
+	if (s < 0)
+		return NULL;
+
+	if (!shm) {
+		if (!send_hello(s, 'S', NULL, 0)) {
+			close(s);
+			return NULL;
+		}
+		return new connection(mgr, s, lossy);
+	}
+
+#ifdef __linux__
+	shm_pair *p = new shm_pair;
+	int door = eventfd(0, EFD_NONBLOCK);
+	int peerdoor = eventfd(0, EFD_NONBLOCK);
+	bool ok = door >= 0 && peerdoor >= 0 && p->create();
+	if (ok) {
+		int fds[3] = { p->fd(), peerdoor, door };
+		ok = send_hello(s, 'M', fds, 3);
+	}
+	if (!ok) {
+		jsl_log(JSL_DBG_1, "connect_to_local: shm setup failed %d\n", errno);
+		if (door >= 0)
+			close(door);
+		if (peerdoor >= 0)
+			close(peerdoor);
+		delete p;
+		close(s);
+		return NULL;
+	}
+	return new shmconn(mgr, s, p, door, peerdoor, lossy);
+#else
+	close(s);
+	return NULL;
+#endif
+}
+
+shmconn::shmconn(chanmgr *m1, int sock, shm_pair *pair, int door, int peerdoor,
+		int lossytest)
+	: connection(m1, door, lossytest), sock_(sock), pair_(pair), peerdoor_(peerdoor)
+{
+	VERIFY(pthread_mutex_init(&send_m_, 0) == 0);
+	int flags = fcntl(sock_, F_GETFL, NULL);
+	VERIFY(fcntl(sock_, F_SETFL, flags | O_NONBLOCK) == 0);
+	PollMgr::Instance()->add_callback(sock_, CB_RDONLY, this);
+	// the peer kicks us only once we're armed, so until here nothing
+	// could reach connection::read_cb
+	if (!pair_->rx.arm()) {
+		uint64_t one = 1;
+		VERIFY(::write(channo(), &one, sizeof(one)) == sizeof(one));
+	}
+}
+
+shmconn::~shmconn()
+{
+	PollMgr::Instance()->block_remove_fd(sock_);
+	pair_->tx.close();
+	pair_->tx.kick(peerdoor_);
+	close(sock_);
+	close(peerdoor_);
+	delete pair_;
+	slab_free(rbuf_.buf);
+	VERIFY(pthread_mutex_destroy(&send_m_) == 0);
+}
+
+bool
+shmconn::send(char *b, int sz)
+{
+	ScopedLock sl(&send_m_);
+	int off = 0;
+	int spins = 0;
+	while (off < sz) {
+		if (isdead() || pair_->rx.closed() || pair_->tx.closed())
+			return false;
+		int n = pair_->tx.write(b + off, sz - off);
+		if (n > 0) {
+			off += n;
+			pair_->tx.kick(peerdoor_);
+			spins = 0;
+		} else if (++spins < 100) {
+			sched_yield();
+		} else {
+			usleep(50);  // ring full: the peer is behind
+		}
+	}
+	return true;
+}
+
+// reassemble PDUs from the rx ring and hand them up, the same framing as
+// connection::readpdu(). false if the chanmgr refused one.
+bool
+shmconn::drain()
+{
+	shmring &rx = pair_->rx;
+	while (1) {
+		if (!rbuf_.buf) {
+			if (rx.readable() < sizeof(int))
+				break;
+			int sz1;
+			VERIFY(rx.read((char *) &sz1, sizeof(sz1)) == sizeof(sz1));
+			int sz = ntohl(sz1);
+			if (sz <= 0 || sz > MAX_PDU) {
+				jsl_log(JSL_DBG_1, "shmconn::drain bad pdu size %d\n", sz);
+				peer_gone();
+				return true;
+			}
+			rbuf_.sz = sz + sizeof(sz1);
+			rbuf_.buf = (char *) slab_alloc(rbuf_.sz);
+			VERIFY(rbuf_.buf);
+			memcpy(rbuf_.buf, &sz1, sizeof(sz1));
+			rbuf_.solong = sizeof(sz1);
+		}
+		rbuf_.solong += rx.read(rbuf_.buf + rbuf_.solong, rbuf_.sz - rbuf_.solong);
+		if (rbuf_.solong < rbuf_.sz)
+			break;
+		if (!deliver(rbuf_.buf, rbuf_.sz))
+			return false;
+		rbuf_.buf = NULL;
+		rbuf_.sz = rbuf_.solong = 0;
+	}
+	// out of bytes; a ring left inconsistent will never have more
+	if (rx.closed()) {
+		jsl_log(JSL_DBG_1, "shmconn::drain rx ring closed\n");
+		peer_gone();
+	}
+	return true;
+}
+
+void
+shmconn::read_cb(int s)
+{
+	if (s == sock_) {
+		char c;
+		ssize_t r = ::read(sock_, &c, 1);
+		if (r == 0 || (r < 0 && errno != EAGAIN && errno != EINTR))
+			peer_gone();
+		return;
+	}
+
+	uint64_t v;
+	while (::read(channo(), &v, sizeof(v)) > 0)
+		;
+	if (isdead())
+		return;
+	while (drain()) {
+		if (isdead() || pair_->rx.arm())
+			return;
+	}
+	// refused, e.g. the dispatch pool is full: try again on the next
+	// pass of the poll loop, as a socket that stays readable would
+	uint64_t one = 1;
+	VERIFY(::write(channo(), &one, sizeof(one)) == sizeof(one));
+}
+
+void
+shmconn::write_cb(int s)
+{
+	// send() never blocks on an fd
+}
+
+// the peer closed its end; like connection::read_cb() on EOF
+void
+shmconn::peer_gone()
+{
+	ScopedLock ml(&m_);
+	if (dead_)
+		return;
+	PollMgr::Instance()->del_callback(sock_, CB_RDWR);
+	PollMgr::Instance()->del_callback(fd_, CB_RDWR);
+	dead_ = true;
+	VERIFY(pthread_cond_broadcast(&send_complete_) == 0);
+}
+
+unixsconn::unixsconn(chanmgr *m1, const char *path, int lossytest)
+	: path_(path), mgr_(m1), lossy_(lossytest)
+{
+	VERIFY(pthread_mutex_init(&m_, 0) == 0);
+	sock_ = unix_listen(path);
+	VERIFY(sock_ >= 0);
+	VERIFY(pipe(pipe_) == 0);
+	th_ = method_thread(thread_layout_place(THR_ROLE_ACCEPT, 0),
+			this, false, &unixsconn::accept_conn);
+}
+
+unixsconn::~unixsconn()
+{
+	VERIFY(close(pipe_[1]) == 0);
+	VERIFY(pthread_join(th_, NULL) == 0);
+	close(pipe_[0]);
+	close(sock_);
+	unlink(path_.c_str());
+
+	for (std::map<int, connection *>::iterator i = conns_.begin();
+			i != conns_.end(); ++i) {
+		i->second->closeconn();
+		i->second->decref();
+	}
+	VERIFY(pthread_mutex_destroy(&m_) == 0);
+}
+
+void
+unixsconn::process_accept()
+{
+	int s = accept(sock_, NULL, NULL);
+	if (s < 0) {
+		jsl_log(JSL_DBG_1, "unixsconn::process_accept: accept failed %d\n", errno);
+		return;
+	}
+
+	// a client that connects and says nothing must not stall the listener
+	struct timeval tv;
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	char mode;
+	int fds[3];
+	int nfds;
+	connection *c = NULL;
+	if (!recv_hello(s, &mode, fds, &nfds)) {
+		close(s);
+		return;
+	}
+	if (mode == 'S' && nfds == 0) {
+		c = new connection(mgr_, s, lossy_);
+	} else if (mode == 'M' && nfds == 3) {
+		shm_pair *p = new shm_pair;
+		if (p->attach(fds[0])) {
+			c = new shmconn(mgr_, s, p, fds[1], fds[2], lossy_);
+		} else {
+			delete p;
+			close(fds[1]);
+			close(fds[2]);
+		}
+	} else {
+		for (int i = 0; i < nfds; i++)
+			close(fds[i]);
+	}
+	if (!c) {
+		jsl_log(JSL_DBG_1, "unixsconn::process_accept: bad hello '%c' %d fds\n",
+				mode, nfds);
+		close(s);
+		return;
+	}
+	jsl_log(JSL_DBG_2, "unixsconn::process_accept: %s connection on %s\n",
+			mode == 'M' ? "shm" : "stream", path_.c_str());
+
+	// garbage collect all dead connections, as tcpsconn does
+	std::map<int, connection *>::iterator i = conns_.begin();
+	while (i != conns_.end()) {
+		if (i->second->isdead()) {
+			i->second->decref();
+			conns_.erase(i++);
+		} else
+			++i;
+	}
+	conns_[c->channo()] = c;
+}
+
+void
+unixsconn::accept_conn()
+{
+	fd_set rfds;
+	int max_fd = pipe_[0] > sock_ ? pipe_[0] : sock_;
+
+	while (1) {
+		FD_ZERO(&rfds);
+		FD_SET(pipe_[0], &rfds);
+		FD_SET(sock_, &rfds);
+
+		int ret = select(max_fd + 1, &rfds, NULL, NULL, NULL);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			jsl_log(JSL_DBG_OFF, "unixsconn::accept_conn failed %d\n", errno);
+			VERIFY(0);
+		}
+
+		if (FD_ISSET(pipe_[0], &rfds))
+			return;  // the destructor closed the pipe
+		if (FD_ISSET(sock_, &rfds))
+			process_accept();
+	}
+}
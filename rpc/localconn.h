@@ -0,0 +1,72 @@
+#ifndef localconn_h
+#define localconn_h
+
+// transports for an rpcc and rpcs on the same host.
+//
+// an rpcs listens on a filesystem path (unixsconn) next to its TCP port.
+// a client connects to the path and says which transport it wants with
+// the first byte:
+//   'S'  stream: PDUs flow over the AF_UNIX socket itself, through an
+//        ordinary connection.
+//   'M'  shared memory: along with the byte the client passes a memfd
+//        holding a shm_pair and one eventfd per side (SCM_RIGHTS); PDUs
+//        flow through the rings (shmconn), and the socket only tells
+//        each side when the other goes away.
+// either way the result is a connection, so chanmgr::got_pdu() and
+// everything above it are unchanged.
+
+#include <map>
+#include <string>
+#include <pthread.h>
+
+#include "connection.h"
+#include "shmring.h"
+
+class shmconn : public connection {
+	public:
+		// takes ownership of sock, pair and both eventfds
+		shmconn(chanmgr *m1, int sock, shm_pair *pair, int door, int peerdoor,
+				int lossytest=0);
+		~shmconn();
+
+		bool send(char *b, int sz);
+		void read_cb(int s);
+		void write_cb(int s);
+
+	private:
+		bool drain();
+		void peer_gone();
+
+		const int sock_;      // AF_UNIX socket, for hangup only
+		shm_pair *pair_;
+		const int peerdoor_;  // the peer's eventfd; ours is channo()
+		charbuf rbuf_;        // PDU being reassembled from pair_->rx
+		pthread_mutex_t send_m_;  // one writer at a time on pair_->tx
+};
+
+class unixsconn {
+	public:
+		unixsconn(chanmgr *m1, const char *path, int lossytest=0);
+		~unixsconn();
+
+		void accept_conn();
+	private:
+
+		pthread_mutex_t m_;
+		pthread_t th_;
+		int pipe_[2];
+
+		int sock_; //file desciptor for accepting connection
+		std::string path_;
+		chanmgr *mgr_;
+		int lossy_;
+		std::map<int, connection *> conns_;
+
+		void process_accept();
+};
+
+int unix_listen(const char *path);
+int unix_connect(const char *path);
+connection *connect_to_local(const char *path, bool shm, chanmgr *mgr, int lossy=0);
+
+#endif
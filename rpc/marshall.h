@@ -10,19 +10,33 @@
 #include <string.h>
 #include <cstddef>
 #include <inttypes.h>
+#include <sys/uio.h>
 #include "lang/verify.h"
 #include "lang/algorithm.h"
+#include "crc32c.h"
+#include "slab.h"
 
 struct req_header {
-	req_header(int x=0, int p=0, int c = 0, int s = 0, int xi = 0):
-		xid(x), proc(p), clt_nonce(c), srv_nonce(s), xid_rep(xi) {}
+	req_header(int x=0, int p=0, int c = 0, int s = 0, int xi = 0, int d = 0):
+		xid(x), proc(p), clt_nonce(c), srv_nonce(s), xid_rep(xi),
+		deadline_ms(d) {}
 	int xid;
 	int proc;
 	unsigned int clt_nonce;
 	unsigned int srv_nonce;
 	int xid_rep;
+	// ms the caller will still wait for the reply, 0 for no limit. a
+	// budget rather than a time, so the hosts' clocks needn't agree;
+	// rpcs turns it into a deadline on arrival. only the compact
+	// header, which both ends agreed to at bind(), carries it; the
+	// fixed header keeps its old layout (RPC_REQ_FIXED_SZ) and always
+	// arrives with 0. must stay the last field.
+	int deadline_ms;
 };
 
+// bytes of req_header in the fixed, pre-negotiation layout
+#define RPC_REQ_FIXED_SZ offsetof(req_header, deadline_ms)
+
 struct reply_header {
 	reply_header(int x=0, int r=0): xid(x), ret(r) {}
 	int xid;
@@ -32,14 +46,91 @@ struct reply_header {
 typedef uint64_t rpc_checksum_t;
 typedef int rpc_sz_t;
 
+#if RPC_CHECKSUMMING
+// the checksum field holds, big-endian, the CRC-32C of everything after
+// it: the header, then the payload. connection::readpdu drops a PDU
+// (size field included) for which this is false.
+static inline bool
+rpc_checksum_ok(const char *pdu, int sz)
+{
+	int at = sizeof(rpc_sz_t) + sizeof(rpc_checksum_t);
+	if (sz < at)
+		return false;
+	const unsigned char *f = (const unsigned char *) pdu + sizeof(rpc_sz_t);
+	uint64_t want = 0;
+	for (unsigned i = 0; i < sizeof(rpc_checksum_t); i++)
+		want = (want << 8) | f[i];
+	return want == crc32c(0, pdu + at, sz - at);
+}
+#endif
+
+// compact encoding: integers as LEB128 varints (7 bits per byte, low
+// group first, high bit set on all but the last byte), signed ones
+// zig-zagged first so small negative values stay short. a compact PDU's
+// header starts with RPC_COMPACT_MARK where a fixed header has the top
+// byte of a non-negative xid, so receivers tell the two apart per PDU.
+enum {
+	RPC_COMPACT_MARK = 0xc5,
+	VARINT_MAX = 10,
+};
+
+static inline int
+varint_put(char *p, uint64_t v)
+{
+	if (v < 0x80) {
+		p[0] = (char) v;
+		return 1;
+	}
+	int n = 0;
+	while (v >= 0x80) {
+		p[n++] = (char) (v | 0x80);
+		v >>= 7;
+	}
+	p[n++] = (char) v;
+	return n;
+}
+
+// bytes consumed, or 0 if p[0..n) holds no complete varint
+static inline int
+varint_get(const char *p, int n, uint64_t *v)
+{
+	if (n > 0 && !(p[0] & 0x80)) {
+		*v = (unsigned char) p[0];
+		return 1;
+	}
+	uint64_t r = 0;
+	for (int i = 0; i < n && i < VARINT_MAX; i++) {
+		r |= (uint64_t) (p[i] & 0x7f) << (7 * i);
+		if (!(p[i] & 0x80)) {
+			*v = r;
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+static inline uint64_t
+zigzag(int64_t v)
+{
+	return ((uint64_t) v << 1) ^ (uint64_t) (v >> 63);
+}
+
+static inline int64_t
+unzigzag(uint64_t v)
+{
+	return (int64_t) (v >> 1) ^ -(int64_t) (v & 1);
+}
+
 enum {
 	//size of initial buffer allocation 
 	DEFAULT_RPC_SZ = 1024,
+	//strings at least this long go in their own segment, see pack_string()
+	MARSHALL_SEG_MIN = 4096,
 #if RPC_CHECKSUMMING
 	//size of rpc_header includes a 4-byte int to be filled by tcpchan and uint64_t checksum
-	RPC_HEADER_SZ = static_max<sizeof(req_header), sizeof(reply_header)>::value + sizeof(rpc_sz_t) + sizeof(rpc_checksum_t)
+	RPC_HEADER_SZ = static_max<RPC_REQ_FIXED_SZ, sizeof(reply_header)>::value + sizeof(rpc_sz_t) + sizeof(rpc_checksum_t)
 #else
-		RPC_HEADER_SZ = static_max<sizeof(req_header), sizeof(reply_header)>::value + sizeof(rpc_sz_t)
+		RPC_HEADER_SZ = static_max<RPC_REQ_FIXED_SZ, sizeof(reply_header)>::value + sizeof(rpc_sz_t)
 #endif
 };
 
@@ -49,28 +140,216 @@ class marshall {
 		int _capa;      // Capacity of the buffer
 		int _ind;       // Read/write head position
 
+		// out-of-line segments, logically inserted into _buf at offset at.
+		// own is a private copy, otherwise p belongs to the caller and
+		// must outlive this marshall.
+		struct segment {
+			int at;
+			const char *p;
+			int n;
+			char *own;
+		};
+		std::vector<segment> _segs;
+		int _seg_bytes;
+		bool _refs_ok;
+
+		bool _compact;  // integers as varints, see varint_put()
+		int _start;     // the PDU starts here: a compact header is
+		                // right-aligned against the payload
+		int _payload;   // the payload starts here, RPC_HEADER_SZ unless
+		                // a compact header needed more room
+
+#if RPC_CHECKSUMMING
+		// the checksum is built as the payload is: _crc covers the payload
+		// in _buf up to _crc_ind and every segment added so far, so
+		// each byte is summed once, while it is still in cache
+		uint32_t _crc;
+		int _crc_ind;
+
+		void crc_fold() {
+			_crc = crc32c(_crc, _buf + _crc_ind, _ind - _crc_ind);
+			_crc_ind = _ind;
+		}
+
+		// fill in the checksum field once the header is in place
+		void seal() {
+			crc_fold();
+			int at = _start + sizeof(rpc_sz_t) + sizeof(rpc_checksum_t);
+			uint64_t c = crc32c_combine(crc32c(0, _buf + at, _payload - at),
+					_crc, _ind + _seg_bytes - _payload);
+			unsigned char *f = (unsigned char *) _buf + _start + sizeof(rpc_sz_t);
+			for (int i = sizeof(rpc_checksum_t) - 1; i >= 0; i--, c >>= 8)
+				f[i] = (unsigned char) c;
+		}
+#endif
+
+		void reserve(int n) {
+			if (_ind + n <= _capa)
+				return;
+			while (_ind + n > _capa)
+				_capa *= 2;
+			_buf = (char *) slab_realloc(_buf, _capa);
+			VERIFY(_buf);
+		}
+
+		// write a header of hn bytes (already encoded) so that it ends
+		// where the payload starts, moving the payload up in the rare
+		// case that it doesn't fit
+		void put_header(const char *hb, int hn) {
+			int pre = sizeof(rpc_sz_t);
+#if RPC_CHECKSUMMING
+			pre += sizeof(rpc_checksum_t);
+#endif
+			int over = pre + hn - _payload;
+			if (over > 0) {
+				reserve(over);
+				memmove(_buf + _payload + over, _buf + _payload, _ind - _payload);
+				_ind += over;
+				_payload += over;
+				for (unsigned i = 0; i < _segs.size(); i++)
+					_segs[i].at += over;
+#if RPC_CHECKSUMMING
+				_crc_ind += over;
+#endif
+			}
+			_start = _payload - pre - hn;
+			memcpy(_buf + _start + pre, hb, hn);
+		}
+
+		// fold the segments back into _buf
+		void flatten() {
+			if (_segs.empty())
+				return;
+			int total = _ind + _seg_bytes;
+			int capa = total > DEFAULT_RPC_SZ ? total : DEFAULT_RPC_SZ;
+			char *nb = (char *) slab_alloc(capa);
+			VERIFY(nb);
+			int src = 0, dst = 0;
+			for (unsigned i = 0; i < _segs.size(); i++) {
+				memcpy(nb + dst, _buf + src, _segs[i].at - src);
+				dst += _segs[i].at - src;
+				src = _segs[i].at;
+				memcpy(nb + dst, _segs[i].p, _segs[i].n);
+				dst += _segs[i].n;
+				slab_free(_segs[i].own);
+			}
+			memcpy(nb + dst, _buf + src, _ind - src);
+			slab_free(_buf);
+			_buf = nb;
+			_capa = capa;
+			_ind = total;
+#if RPC_CHECKSUMMING
+			// every segment lay before _crc_ind
+			_crc_ind += _seg_bytes;
+#endif
+			_segs.clear();
+			_seg_bytes = 0;
+		}
+
 	public:
 		marshall() {
-			_buf = (char *) malloc(sizeof(char)*DEFAULT_RPC_SZ);
+			_buf = (char *) slab_alloc(sizeof(char)*DEFAULT_RPC_SZ);
 			VERIFY(_buf);
 			_capa = DEFAULT_RPC_SZ;
 			_ind = RPC_HEADER_SZ;
+			_seg_bytes = 0;
+			_refs_ok = false;
+			_compact = false;
+			_start = 0;
+			_payload = RPC_HEADER_SZ;
+#if RPC_CHECKSUMMING
+			_crc = 0;
+			_crc_ind = RPC_HEADER_SZ;
+#endif
 		}
 
 		~marshall() { 
 			if (_buf) 
-				free(_buf); 
+				slab_free(_buf); 
+			for (unsigned i = 0; i < _segs.size(); i++)
+				slab_free(_segs[i].own);
 		}
 
-		int size() { return _ind;}
-		char *cstr() { return _buf;}
+		int size() { return _ind + _seg_bytes - _start;}
+		char *cstr() { flatten(); return _buf + _start;}
+
+		// pack integers (and headers) in the compact encoding; set before
+		// packing anything, e.g. once rpcc has negotiated it with the server
+		void set_compact(bool c) { _compact = c; }
+		bool compact() { return _compact; }
+
+		void pack_uvarint(uint64_t v) {
+			reserve(VARINT_MAX);
+			if (v < 0x80)
+				_buf[_ind++] = (char) v;
+			else
+				_ind += varint_put(_buf + _ind, v);
+		}
+		void pack_svarint(int64_t v) { pack_uvarint(zigzag(v)); }
 
 		void rawbyte(unsigned char);
 		void rawbytes(const char *, int);
 
+		// append n bytes as a segment of their own, without growing _buf.
+		// by reference if the caller allowed it with refs_ok().
+		void rawbytes_seg(const char *p, int n) {
+#if RPC_CHECKSUMMING
+			crc_fold();
+			_crc = crc32c(_crc, p, n);
+#endif
+			segment s;
+			s.at = _ind;
+			s.n = n;
+			if (_refs_ok) {
+				s.p = p;
+				s.own = NULL;
+			} else {
+				s.own = (char *) slab_alloc(n);
+				VERIFY(s.own);
+				memcpy(s.own, p, n);
+				s.p = s.own;
+			}
+			_segs.push_back(s);
+			_seg_bytes += n;
+		}
+
+		// promise that appended strings outlive this marshall, e.g. the
+		// arguments of a synchronous rpcc::call()
+		void refs_ok(bool ok) { _refs_ok = ok; }
+
+		// same wire format as operator<<(marshall &, const std::string &)
+		void pack_string(const std::string &s) {
+			pack((int) s.size());
+			if ((int) s.size() >= MARSHALL_SEG_MIN)
+				rawbytes_seg(s.data(), s.size());
+			else
+				rawbytes(s.data(), s.size());
+		}
+
+		// gather list for the whole PDU, header first. valid until the
+		// marshall is next modified.
+		void iov(std::vector<struct iovec> *v) {
+			int src = _start;
+			v->clear();
+			for (unsigned i = 0; i < _segs.size(); i++) {
+				if (_segs[i].at > src) {
+					struct iovec e = { _buf + src, (size_t) (_segs[i].at - src) };
+					v->push_back(e);
+				}
+				struct iovec e = { (void *) _segs[i].p, (size_t) _segs[i].n };
+				v->push_back(e);
+				src = _segs[i].at;
+			}
+			if (_ind > src) {
+				struct iovec e = { _buf + src, (size_t) (_ind - src) };
+				v->push_back(e);
+			}
+		}
+
 		// Return the current content (excluding header) as a string
 		std::string get_content() { 
-			return std::string(_buf+RPC_HEADER_SZ,_ind-RPC_HEADER_SZ);
+			flatten();
+			return std::string(_buf+_payload,_ind-_payload);
 		}
 
 		// Return the current content (excluding header) as a string
@@ -81,11 +360,31 @@ class marshall {
 		void pack(int i);
 
 		void pack_req_header(const req_header &h) {
+			if (_compact) {
+				char hb[1 + 6 * 5];
+				int hn = 0;
+				hb[hn++] = (char) RPC_COMPACT_MARK;
+				hn += varint_put(hb + hn, (unsigned int) h.xid);
+				hn += varint_put(hb + hn, (unsigned int) h.proc);
+				hn += varint_put(hb + hn, h.clt_nonce);
+				hn += varint_put(hb + hn, h.srv_nonce);
+				hn += varint_put(hb + hn, (unsigned int) h.xid_rep);
+				hn += varint_put(hb + hn, (unsigned int) h.deadline_ms);
+				put_header(hb, hn);
+#if RPC_CHECKSUMMING
+				seal();
+#endif
+				return;
+			}
+			_start = 0;
 			int saved_sz = _ind;
 			//leave the first 4-byte empty for channel to fill size of pdu
 			_ind = sizeof(rpc_sz_t); 
 #if RPC_CHECKSUMMING
 			_ind += sizeof(rpc_checksum_t);
+			// the whole slot is summed; don't leave a short header's
+			// tail uninitialized
+			memset(_buf + _ind, 0, RPC_HEADER_SZ - _ind);
 #endif
 			pack(h.xid);
 			pack(h.proc);
@@ -93,21 +392,50 @@ class marshall {
 			pack((int)h.srv_nonce);
 			pack(h.xid_rep);
 			_ind = saved_sz;
+#if RPC_CHECKSUMMING
+			seal();
+#endif
 		}
 
 		void pack_reply_header(const reply_header &h) {
+			if (_compact) {
+				char hb[1 + 2 * 10];
+				int hn = 0;
+				hb[hn++] = (char) RPC_COMPACT_MARK;
+				hn += varint_put(hb + hn, (unsigned int) h.xid);
+				hn += varint_put(hb + hn, zigzag(h.ret));
+				put_header(hb, hn);
+#if RPC_CHECKSUMMING
+				seal();
+#endif
+				return;
+			}
+			_start = 0;
 			int saved_sz = _ind;
 			//leave the first 4-byte empty for channel to fill size of pdu
 			_ind = sizeof(rpc_sz_t); 
 #if RPC_CHECKSUMMING
 			_ind += sizeof(rpc_checksum_t);
+			// the whole slot is summed; don't leave a short header's
+			// tail uninitialized
+			memset(_buf + _ind, 0, RPC_HEADER_SZ - _ind);
 #endif
 			pack(h.xid);
 			pack(h.ret);
 			_ind = saved_sz;
+#if RPC_CHECKSUMMING
+			seal();
+#endif
 		}
 
+		// the caller owns *b from now on; release it with slab_free()
 		void take_buf(char **b, int *s) {
+			flatten();
+			if (_start) {
+				memmove(_buf, _buf + _start, _ind - _start);
+				_ind -= _start;
+				_start = 0;
+			}
 			*b = _buf;
 			*s = _ind;
 			_buf = NULL;
@@ -131,16 +459,17 @@ class unmarshall {
 		int _sz;
 		int _ind;
 		bool _ok;
+		bool _compact;  // set by unpack_*_header() from the PDU itself
 	public:
-		unmarshall(): _buf(NULL),_sz(0),_ind(0),_ok(false) {}
-		unmarshall(char *b, int sz): _buf(b),_sz(sz),_ind(),_ok(true) {}
-		unmarshall(const std::string &s) : _buf(NULL),_sz(0),_ind(0),_ok(false) 
+		unmarshall(): _buf(NULL),_sz(0),_ind(0),_ok(false),_compact(false) {}
+		unmarshall(char *b, int sz): _buf(b),_sz(sz),_ind(),_ok(true),_compact(false) {}
+		unmarshall(const std::string &s) : _buf(NULL),_sz(0),_ind(0),_ok(false),_compact(false)
 		{
 			//take the content which does not exclude a RPC header from a string
 			take_content(s);
 		}
 		~unmarshall() {
-			if (_buf) free(_buf);
+			if (_buf) slab_free(_buf);
 		}
 
 		//take contents from another unmarshall object
@@ -149,7 +478,7 @@ class unmarshall {
 		//take the content which does not exclude a RPC header from a string
 		void take_content(const std::string &s) {
 			_sz = s.size()+RPC_HEADER_SZ;
-			_buf = (char *)realloc(_buf,_sz);
+			_buf = (char *)slab_realloc(_buf,_sz);
 			VERIFY(_buf);
 			_ind = RPC_HEADER_SZ;
 			memcpy(_buf+_ind, s.data(), s.size());
@@ -165,6 +494,24 @@ class unmarshall {
 		int ind() { return _ind;}
 		int size() { return _sz;}
 		void unpack(int *); //non-const ref
+
+		bool compact() { return _compact; }
+		void set_compact(bool c) { _compact = c; }
+
+		uint64_t unpack_uvarint() {
+			uint64_t v = 0;
+			if (_ind < _sz && !(_buf[_ind] & 0x80))
+				return (unsigned char) _buf[_ind++];
+			int n = varint_get(_buf + _ind, _sz - _ind, &v);
+			if (!n)
+				_ok = false;
+			_ind += n;
+			return v;
+		}
+		int64_t unpack_svarint() { return unzigzag(unpack_uvarint()); }
+		// the caller owns *b from now on; release it with slab_free(),
+		// as for marshall::take_buf(), whether it came from the slabs
+		// (take_content()) or was passed in by the caller
 		void take_buf(char **b, int *sz) {
 			*b = _buf;
 			*sz = _sz;
@@ -178,11 +525,24 @@ class unmarshall {
 #if RPC_CHECKSUMMING
 			_ind += sizeof(rpc_checksum_t);
 #endif
+			if (_ind < _sz && (unsigned char) _buf[_ind] == RPC_COMPACT_MARK) {
+				// the payload follows right after
+				_compact = true;
+				_ind++;
+				h->xid = unpack_uvarint();
+				h->proc = unpack_uvarint();
+				h->clt_nonce = unpack_uvarint();
+				h->srv_nonce = unpack_uvarint();
+				h->xid_rep = unpack_uvarint();
+				h->deadline_ms = unpack_uvarint();
+				return;
+			}
 			unpack(&h->xid);
 			unpack(&h->proc);
 			unpack((int *)&h->clt_nonce);
 			unpack((int *)&h->srv_nonce);
 			unpack(&h->xid_rep);
+			h->deadline_ms = 0;
 			_ind = RPC_HEADER_SZ;
 		}
 
@@ -192,6 +552,13 @@ class unmarshall {
 #if RPC_CHECKSUMMING
 			_ind += sizeof(rpc_checksum_t);
 #endif
+			if (_ind < _sz && (unsigned char) _buf[_ind] == RPC_COMPACT_MARK) {
+				_compact = true;
+				_ind++;
+				h->xid = unpack_uvarint();
+				h->ret = unzigzag(unpack_uvarint());
+				return;
+			}
 			unpack(&h->xid);
 			unpack(&h->ret);
 			_ind = RPC_HEADER_SZ;
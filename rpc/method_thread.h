@@ -2,23 +2,48 @@
 #define method_thread_h
 
 // method_thread(): start a thread that runs an object method.
-// returns a pthread_t on success, and zero on error.
+// returns a pthread_t on success, and zero on error. the variants
+// taking a thread_place first set its stack size and cpu, e.g. from
+// thread_layout_place().
 
+#include <errno.h>
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include "lang/verify.h"
+#include "thread_layout.h"
 
 static pthread_t
-method_thread_parent(void *(*fn)(void *), void *arg, bool detach)
+method_thread_parent(void *(*fn)(void *), void *arg, bool detach,
+		const thread_place &pl)
 {
 	pthread_t th;
 	pthread_attr_t attr;
 	pthread_attr_init(&attr);
-	// set stack size to 100K, so we don't run out of memory
-	pthread_attr_setstacksize(&attr, 100*1024);
+	pthread_attr_setstacksize(&attr, pl.stack);
+#ifdef __linux__
+	if (pl.cpu >= 0 && pl.cpu < CPU_SETSIZE) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(pl.cpu, &cpus);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+	}
+#endif
 	int err = pthread_create(&th, &attr, fn, arg);
+#ifdef __linux__
+	if (err == EINVAL && pl.cpu >= 0) {
+		// the cpu was taken out of our affinity mask after the
+		// layout was checked; run the thread unpinned
+		fprintf(stderr, "method_thread: can't pin to cpu %d, not pinning\n",
+				pl.cpu);
+		cpu_set_t cpus;
+		VERIFY(sched_getaffinity(0, sizeof(cpus), &cpus) == 0);
+		pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+		err = pthread_create(&th, &attr, fn, arg);
+	}
+#endif
 	pthread_attr_destroy(&attr);
 	if (err != 0) {
 		fprintf(stderr, "pthread_create ret %d %s\n", err, strerror(err));
@@ -45,8 +70,8 @@ method_thread_child()
 	VERIFY(pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, &oldtype) == 0);
 }
 
-template <class C> pthread_t 
-method_thread(C *o, bool detach, void (C::*m)())
+template <class C> pthread_t
+method_thread(const thread_place &pl, C *o, bool detach, void (C::*m)())
 {
 	class XXX {
 		public:
@@ -65,11 +90,11 @@ method_thread(C *o, bool detach, void (C::*m)())
 	XXX *x = new XXX;
 	x->o = o;
 	x->m = m;
-	return method_thread_parent(&XXX::yyy, (void *) x, detach);
+	return method_thread_parent(&XXX::yyy, (void *) x, detach, pl);
 }
 
 template <class C, class A> pthread_t
-method_thread(C *o, bool detach, void (C::*m)(A), A a)
+method_thread(const thread_place &pl, C *o, bool detach, void (C::*m)(A), A a)
 {
 	class XXX {
 		public:
@@ -91,7 +116,7 @@ method_thread(C *o, bool detach, void (C::*m)(A), A a)
 	x->o = o;
 	x->m = m;
 	x->a = a;
-	return method_thread_parent(&XXX::yyy, (void *) x, detach);
+	return method_thread_parent(&XXX::yyy, (void *) x, detach, pl);
 }
 
 namespace {
@@ -119,18 +144,20 @@ namespace {
 }
 
 template <class C, class A1, class A2> pthread_t
-method_thread(C *o, bool detach, void (C::*m)(A1 , A2 ), A1 a1, A2 a2)
+method_thread(const thread_place &pl, C *o, bool detach,
+		void (C::*m)(A1 , A2 ), A1 a1, A2 a2)
 {
 	XXX<C,A1,A2> *x = new XXX<C,A1,A2>;
 	x->o = o;
 	x->m = m;
 	x->a1 = a1;
 	x->a2 = a2;
-	return method_thread_parent(&XXX<C,A1,A2>::yyy, (void *) x, detach);
+	return method_thread_parent(&XXX<C,A1,A2>::yyy, (void *) x, detach, pl);
 }
 
 template <class C, class A1, class A2, class A3> pthread_t
-method_thread(C *o, bool detach, void (C::*m)(A1 , A2, A3 ), A1 a1, A2 a2, A3 a3)
+method_thread(const thread_place &pl, C *o, bool detach,
+		void (C::*m)(A1 , A2, A3 ), A1 a1, A2 a2, A3 a3)
 {
 	class XXX {
 		public:
@@ -158,7 +185,31 @@ method_thread(C *o, bool detach, void (C::*m)(A1 , A2, A3 ), A1 a1, A2 a2, A3 a3
 	x->a1 = a1;
 	x->a2 = a2;
 	x->a3 = a3;
-	return method_thread_parent(&XXX::yyy, (void *) x, detach);
+	return method_thread_parent(&XXX::yyy, (void *) x, detach, pl);
+}
+
+template <class C> pthread_t
+method_thread(C *o, bool detach, void (C::*m)())
+{
+	return method_thread(thread_place(), o, detach, m);
+}
+
+template <class C, class A> pthread_t
+method_thread(C *o, bool detach, void (C::*m)(A), A a)
+{
+	return method_thread(thread_place(), o, detach, m, a);
+}
+
+template <class C, class A1, class A2> pthread_t
+method_thread(C *o, bool detach, void (C::*m)(A1 , A2 ), A1 a1, A2 a2)
+{
+	return method_thread(thread_place(), o, detach, m, a1, a2);
+}
+
+template <class C, class A1, class A2, class A3> pthread_t
+method_thread(C *o, bool detach, void (C::*m)(A1 , A2, A3 ), A1 a1, A2 a2, A3 a3)
+{
+	return method_thread(thread_place(), o, detach, m, a1, a2, a3);
 }
 
 #endif
@@ -0,0 +1,277 @@
+#ifndef mpmc_fifo_h
+#define mpmc_fifo_h
+
+// bounded lock-free fifo for many producers and many consumers, with the
+// same enq()/deq() semantics as fifo<T> but no list node or mutex per
+// element.
+//
+// an array of cells, each with a sequence number that says whether it is
+// ready to be written or read on the current lap (D. Vyukov's bounded
+// MPMC queue). head_ and tail_ sit on their own cache lines so producers
+// and consumers don't false-share. a thread that finds the queue empty
+// (or full) spins MPMC_SPINS times (not at all on a uniprocessor) and
+// then parks on a futex until the other side signals. a signal is only
+// sent when somebody is parked and no earlier wakeup is still pending; a
+// woken thread that leaves work behind passes the wakeup on.
+//
+// T must be default-constructible and cheap to copy, e.g. a pointer.
+//
+// nothing in the library uses it yet; only fifobench does. it is a
+// drop-in for a fifo<T> with a limit, but the fifos the library has
+// now (extent_client's aop queue, the coroutine overflow queue) must
+// never block their producer, so they stay unbounded fifo<T>s, and
+// ThrPool keeps its own per-worker deques.
+
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include "lang/verify.h"
+
+enum {
+	MPMC_CACHELINE = 64,
+	MPMC_DEFAULT_CAP = 4096,  // capacity of mpmc_fifo(0)
+	MPMC_SPINS = 128,         // empty polls before parking
+};
+
+static inline int
+mpmc_spins()
+{
+	static int spins = -1;
+	if (spins < 0)
+		spins = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? MPMC_SPINS : 0;
+	return spins;
+}
+
+static inline void
+mpmc_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+// a counter threads sleep on until someone bumps it. a waiter calls
+// prepare(), re-checks its condition, then wait()s or cancel()s; this
+// ordering means a notify() between the check and the sleep is not lost.
+class mpmc_event {
+	public:
+		mpmc_event() : ev_(0), waiters_(0), signaled_(0) {
+#ifndef __linux__
+			VERIFY(pthread_mutex_init(&m_, 0) == 0);
+			VERIFY(pthread_cond_init(&c_, 0) == 0);
+#endif
+		}
+		~mpmc_event() {
+#ifndef __linux__
+			VERIFY(pthread_mutex_destroy(&m_) == 0);
+			VERIFY(pthread_cond_destroy(&c_) == 0);
+#endif
+		}
+
+		unsigned int prepare() {
+			__atomic_add_fetch(&waiters_, 1, __ATOMIC_SEQ_CST);
+			return __atomic_load_n(&ev_, __ATOMIC_SEQ_CST);
+		}
+		void cancel() {
+			// any pending wakeup has been delivered or is no longer needed
+			__atomic_store_n(&signaled_, 0, __ATOMIC_SEQ_CST);
+			__atomic_sub_fetch(&waiters_, 1, __ATOMIC_SEQ_CST);
+		}
+		void wait(unsigned int epoch) {
+#ifdef __linux__
+			syscall(SYS_futex, &ev_, FUTEX_WAIT_PRIVATE, epoch, NULL, NULL, 0);
+#else
+			VERIFY(pthread_mutex_lock(&m_) == 0);
+			while (__atomic_load_n(&ev_, __ATOMIC_SEQ_CST) == epoch)
+				VERIFY(pthread_cond_wait(&c_, &m_) == 0);
+			VERIFY(pthread_mutex_unlock(&m_) == 0);
+#endif
+			cancel();
+		}
+		void notify() {
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if (!__atomic_load_n(&waiters_, __ATOMIC_SEQ_CST))
+				return;
+			if (__atomic_exchange_n(&signaled_, 1, __ATOMIC_SEQ_CST))
+				return;  // a woken thread hasn't run yet; it will chain
+#ifdef __linux__
+			__atomic_add_fetch(&ev_, 1, __ATOMIC_SEQ_CST);
+			syscall(SYS_futex, &ev_, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+			VERIFY(pthread_mutex_lock(&m_) == 0);
+			__atomic_add_fetch(&ev_, 1, __ATOMIC_SEQ_CST);
+			VERIFY(pthread_cond_signal(&c_) == 0);
+			VERIFY(pthread_mutex_unlock(&m_) == 0);
+#endif
+		}
+
+	private:
+		unsigned int ev_;
+		unsigned int waiters_;
+		unsigned int signaled_;
+#ifndef __linux__
+		pthread_mutex_t m_;
+		pthread_cond_t c_;
+#endif
+};
+
+template<class T>
+class mpmc_fifo {
+	public:
+		// capacity is limit rounded up to a power of two
+		mpmc_fifo(int limit=0);
+		~mpmc_fifo();
+		bool enq(T, bool blocking=true);
+		void deq(T *);
+		bool trydeq(T *);
+		unsigned int size();
+
+	private:
+		struct cell {
+			unsigned long seq;
+			T v;
+		};
+
+		bool tryenq(T e);
+
+		cell *cells_;
+		unsigned long mask_;
+		char pad0_[MPMC_CACHELINE];
+		unsigned long head_ __attribute__((aligned(MPMC_CACHELINE)));  // next enq
+		char pad1_[MPMC_CACHELINE];
+		unsigned long tail_ __attribute__((aligned(MPMC_CACHELINE)));  // next deq
+		char pad2_[MPMC_CACHELINE];
+		mpmc_event non_empty_ __attribute__((aligned(MPMC_CACHELINE)));
+		mpmc_event has_space_ __attribute__((aligned(MPMC_CACHELINE)));
+};
+
+template<class T>
+mpmc_fifo<T>::mpmc_fifo(int limit) : head_(0), tail_(0)
+{
+	unsigned long n = 2;
+	while (n < (unsigned long) (limit > 0 ? limit : MPMC_DEFAULT_CAP))
+		n <<= 1;
+	cells_ = new cell[n];
+	mask_ = n - 1;
+	for (unsigned long i = 0; i < n; i++)
+		cells_[i].seq = i;
+}
+
+template<class T>
+mpmc_fifo<T>::~mpmc_fifo()
+{
+	//fifo is to be deleted only when no threads are using it!
+	delete[] cells_;
+}
+
+template<class T> unsigned int
+mpmc_fifo<T>::size()
+{
+	unsigned long t = __atomic_load_n(&tail_, __ATOMIC_ACQUIRE);
+	unsigned long h = __atomic_load_n(&head_, __ATOMIC_ACQUIRE);
+	return h > t ? h - t : 0;
+}
+
+template<class T> bool
+mpmc_fifo<T>::tryenq(T e)
+{
+	unsigned long pos = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+	cell *c;
+	while (1) {
+		c = &cells_[pos & mask_];
+		unsigned long seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		long dif = (long) seq - (long) pos;
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&head_, &pos, pos + 1, true,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			return false;  // full: the cell still holds last lap's element
+		} else {
+			pos = __atomic_load_n(&head_, __ATOMIC_RELAXED);
+		}
+	}
+	c->v = e;
+	__atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+template<class T> bool
+mpmc_fifo<T>::trydeq(T *e)
+{
+	unsigned long pos = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+	cell *c;
+	while (1) {
+		c = &cells_[pos & mask_];
+		unsigned long seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		long dif = (long) seq - (long) (pos + 1);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&tail_, &pos, pos + 1, true,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			return false;  // empty
+		} else {
+			pos = __atomic_load_n(&tail_, __ATOMIC_RELAXED);
+		}
+	}
+	*e = c->v;
+	__atomic_store_n(&c->seq, pos + mask_ + 1, __ATOMIC_RELEASE);
+	has_space_.notify();
+	return true;
+}
+
+template<class T> bool
+mpmc_fifo<T>::enq(T e, bool blocking)
+{
+	int spins = 0;
+	bool parked = false;
+	while (!tryenq(e)) {
+		if (!blocking)
+			return false;
+		if (spins++ < mpmc_spins()) {
+			mpmc_relax();
+			continue;
+		}
+		unsigned int epoch = has_space_.prepare();
+		if (tryenq(e)) {
+			has_space_.cancel();
+			break;
+		}
+		has_space_.wait(epoch);
+		parked = true;
+	}
+	non_empty_.notify();
+	if (parked && size() <= mask_)
+		has_space_.notify();
+	return true;
+}
+
+template<class T> void
+mpmc_fifo<T>::deq(T *e)
+{
+	int spins = 0;
+	bool parked = false;
+	while (!trydeq(e)) {
+		if (spins++ < mpmc_spins()) {
+			mpmc_relax();
+			continue;
+		}
+		unsigned int epoch = non_empty_.prepare();
+		if (trydeq(e)) {
+			non_empty_.cancel();
+			return;
+		}
+		non_empty_.wait(epoch);
+		parked = true;
+	}
+	if (parked && size() > 0)
+		non_empty_.notify();
+}
+
+#endif
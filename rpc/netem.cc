@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <queue>
+#include <vector>
+
+#include "netem.h"
+#include "connection.h"
+#include "method_thread.h"
+#include "slab.h"
+#include "slock.h"
+#include "stats.h"
+
+static stat_counter netem_delivered("netem.delivered");
+static stat_counter netem_reordered("netem.reordered");
+static stat_counter netem_dropped("netem.dropped");
+static stat_counter netem_refused("netem.refused");
+
+static uint64_t
+now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static bool
+parse_scaled(const char *v, int len, const char *const *units,
+		const uint64_t *scale, uint64_t *out)
+{
+	char *end;
+	double x = strtod(v, &end);
+	if (end == v || x < 0)
+		return false;
+	int ulen = v + len - end;
+	for (int i = 0; units[i]; i++) {
+		if ((int) strlen(units[i]) == ulen && !strncmp(end, units[i], ulen)) {
+			*out = (uint64_t) (x * scale[i]);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool
+netem_params::parse(const char *spec)
+{
+	static const char *const time_units[] = { "us", "ms", "s", NULL };
+	static const uint64_t time_scale[] = { 1, 1000, 1000000 };
+	static const char *const rate_units[] = { "bit", "kbit", "mbit", "gbit", NULL };
+	// to bytes per second
+	static const uint64_t rate_scale[] = { 1, 1000, 1000000, 1000000000 };
+
+	*this = netem_params();
+	const char *s = spec;
+	while (*s) {
+		const char *eq = strchr(s, '=');
+		if (!eq)
+			return false;
+		const char *v = eq + 1;
+		const char *end = strchr(v, ',');
+		int vlen = end ? end - v : strlen(v);
+		int klen = eq - s;
+		bool ok;
+		if (klen == 5 && !strncmp(s, "delay", 5))
+			ok = parse_scaled(v, vlen, time_units, time_scale, &delay_us);
+		else if (klen == 6 && !strncmp(s, "jitter", 6))
+			ok = parse_scaled(v, vlen, time_units, time_scale, &jitter_us);
+		else if (klen == 4 && !strncmp(s, "rate", 4)) {
+			ok = parse_scaled(v, vlen, rate_units, rate_scale, &rate_Bps);
+			rate_Bps /= 8;
+		} else if (klen == 7 && !strncmp(s, "reorder", 7)) {
+			reorder_pct = atoi(v);
+			ok = reorder_pct >= 0 && reorder_pct <= 100;
+		} else
+			ok = false;
+		if (!ok)
+			return false;
+		s = end ? end + 1 : v + vlen;
+	}
+	return true;
+}
+
+netem_params
+netem_params::from_env()
+{
+	netem_params p;
+	const char *e = getenv("RPC_NETEM");
+	if (e && !p.parse(e)) {
+		fprintf(stderr, "RPC_NETEM: cannot parse \"%s\", ignoring it\n", e);
+		p = netem_params();
+	}
+	return p;
+}
+
+namespace {
+
+// the PDUs in flight on every emulated link, by due time
+class netem_timer {
+	public:
+		static netem_timer *instance();
+		void add(uint64_t due, chanmgr *mgr, connection *c, char *b, int sz);
+
+	private:
+		struct pending {
+			uint64_t due;
+			uint64_t seq;  // FIFO among equal due times
+			chanmgr *mgr;
+			connection *c;
+			char *b;
+			int sz;
+			int tries;     // refused by got_pdu so far
+			bool operator<(const pending &o) const {
+				// priority_queue pops the largest
+				return due != o.due ? due > o.due : seq > o.seq;
+			}
+		};
+
+		netem_timer();
+		void loop();
+
+		pthread_mutex_t m_;
+		pthread_cond_t c_;
+		std::priority_queue<pending> q_;
+		uint64_t seq_;
+};
+
+netem_timer::netem_timer() : seq_(0)
+{
+	VERIFY(pthread_mutex_init(&m_, 0) == 0);
+	pthread_condattr_t ca;
+	VERIFY(pthread_condattr_init(&ca) == 0);
+	VERIFY(pthread_condattr_setclock(&ca, CLOCK_MONOTONIC) == 0);
+	VERIFY(pthread_cond_init(&c_, &ca) == 0);
+	VERIFY(pthread_condattr_destroy(&ca) == 0);
+	method_thread(this, true, &netem_timer::loop);
+}
+
+netem_timer *
+netem_timer::instance()
+{
+	static netem_timer *t = new netem_timer();
+	return t;
+}
+
+void
+netem_timer::add(uint64_t due, chanmgr *mgr, connection *c, char *b, int sz)
+{
+	ScopedLock ml(&m_);
+	pending p = { due, seq_++, mgr, c, b, sz, 0 };
+	bool first = q_.empty() || p.due < q_.top().due;
+	q_.push(p);
+	if (first)
+		VERIFY(pthread_cond_signal(&c_) == 0);
+}
+
+void
+netem_timer::loop()
+{
+	ScopedLock ml(&m_);
+	for (;;) {
+		if (q_.empty()) {
+			VERIFY(pthread_cond_wait(&c_, &m_) == 0);
+			continue;
+		}
+		uint64_t now = now_ns();
+		if (q_.top().due > now) {
+			struct timespec ts;
+			ts.tv_sec = q_.top().due / 1000000000;
+			ts.tv_nsec = q_.top().due % 1000000000;
+			pthread_cond_timedwait(&c_, &m_, &ts);
+			continue;
+		}
+		pending p = q_.top();
+		q_.pop();
+
+		// got_pdu may send, and send may wait; never with m_ held
+		VERIFY(pthread_mutex_unlock(&m_) == 0);
+		bool done = true;
+		if (p.c->isdead()) {
+			slab_free(p.b);
+			netem_dropped.add();
+		} else if (p.mgr->got_pdu(p.c, p.b, p.sz)) {
+			netem_delivered.add();
+		} else if (++p.tries >= NETEM_RETRIES) {
+			// the receiver is stuck; lose it as a full link would
+			slab_free(p.b);
+			netem_refused.add();
+		} else {
+			done = false;  // not taken; try again shortly
+		}
+		if (done)
+			p.c->decref();
+		VERIFY(pthread_mutex_lock(&m_) == 0);
+		if (!done) {
+			p.due = now_ns() + (uint64_t) NETEM_RETRY_MS * 1000000;
+			p.seq = seq_++;
+			q_.push(p);
+		}
+	}
+}
+
+}
+
+netem::netem(const netem_params &p)
+	: p_(p), link_free_ns_(0), last_due_ns_(0), seed_(time(0) ^ (uintptr_t) this)
+{
+	VERIFY(pthread_mutex_init(&m_, 0) == 0);
+}
+
+// PDUs still in flight hold their connection, not this
+netem::~netem()
+{
+	VERIFY(pthread_mutex_destroy(&m_) == 0);
+}
+
+void
+netem::deliver(chanmgr *mgr, connection *c, char *b, int sz)
+{
+	uint64_t now = now_ns(), due;
+	{
+		ScopedLock ml(&m_);
+		uint64_t sent = now;
+		if (p_.rate_Bps) {
+			uint64_t start = link_free_ns_ > now ? link_free_ns_ : now;
+			sent = start + (uint64_t) sz * 1000000000 / p_.rate_Bps;
+			link_free_ns_ = sent;
+		}
+		if (p_.reorder_pct && (int) (rand_r(&seed_) % 100) < p_.reorder_pct) {
+			due = sent;
+			netem_reordered.add();
+		} else {
+			int64_t d = p_.delay_us * 1000;
+			if (p_.jitter_us) {
+				int64_t j = p_.jitter_us * 1000;
+				uint64_t r = (uint64_t) rand_r(&seed_) << 31 | rand_r(&seed_);
+				d += (int64_t) (r % (2 * j + 1)) - j;
+			}
+			due = sent + (d > 0 ? d : 0);
+			if (due < last_due_ns_)
+				due = last_due_ns_;
+			last_due_ns_ = due;
+		}
+	}
+	c->incref();
+	netem_timer::instance()->add(due, mgr, c, b, sz);
+}
@@ -0,0 +1,66 @@
+#ifndef netem_h
+#define netem_h
+
+// network emulation for benchmarking on one box: a connection with a
+// netem holds each PDU it receives for a while before handing it to
+// chanmgr::got_pdu(), as if it had crossed a slower, longer link.
+//
+// a PDU first queues for the link (rate: sz / rate after the previous
+// PDU has gone), then travels for delay +- jitter. unless reordering,
+// PDUs arrive in order even with jitter, like one TCP stream; with
+// reorder=P, P percent of PDUs skip the delay and overtake the others.
+// delays are one-way: set it on both ends (e.g. RPC_NETEM in both
+// processes) for a round trip of twice the delay.
+//
+// a single timer thread delivers every connection's PDUs when due.
+
+#include <pthread.h>
+#include <stdint.h>
+
+enum {
+	NETEM_RETRY_MS = 1,
+	NETEM_RETRIES = 1000,
+};
+
+class chanmgr;
+class connection;
+
+struct netem_params {
+	netem_params() : delay_us(0), jitter_us(0), rate_Bps(0), reorder_pct(0) { }
+
+	uint64_t delay_us;
+	uint64_t jitter_us;
+	uint64_t rate_Bps;  // 0 for no limit
+	int reorder_pct;
+
+	// "delay=20ms,jitter=2ms,rate=100mbit,reorder=1"; delay and jitter
+	// in us, ms or s, rate in bit, kbit, mbit or gbit (per second).
+	// false on a malformed spec.
+	bool parse(const char *spec);
+	bool active() const { return delay_us || jitter_us || rate_Bps || reorder_pct; }
+
+	// from RPC_NETEM, inactive if unset or malformed
+	static netem_params from_env();
+};
+
+class netem {
+	public:
+		netem(const netem_params &p);
+		~netem();
+
+		// deliver b (sz bytes, malloc'd) to mgr->got_pdu(c, ...) when
+		// the emulated link would have. holds a reference to c until
+		// then; a PDU for a connection that died meanwhile is dropped,
+		// and so is one got_pdu() still refuses after NETEM_RETRIES
+		// tries NETEM_RETRY_MS apart.
+		void deliver(chanmgr *mgr, connection *c, char *b, int sz);
+
+	private:
+		const netem_params p_;
+		pthread_mutex_t m_;
+		uint64_t link_free_ns_;  // when the link has sent what it has
+		uint64_t last_due_ns_;   // keeps unreordered PDUs in order
+		unsigned int seed_;
+};
+
+#endif
@@ -34,6 +34,8 @@ class aio_callback {
 		virtual ~aio_callback() {}
 };
 
+// single wait thread, at most MAX_POLL_FDS fds; see Reactor (reactor.h)
+// for the multi-loop edge-triggered replacement.
 class PollMgr {
 	public:
 		PollMgr();
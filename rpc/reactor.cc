@@ -0,0 +1,268 @@
+#ifdef __linux__
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "reactor.h"
+#include "method_thread.h"
+#include "thread_layout.h"
+#include "slock.h"
+#include "stats.h"
+#include "jsl_log.h"
+
+static stat_counter reactor_batches("reactor.batches");
+static stat_counter reactor_events("reactor.events");
+
+static Reactor *reactor_instance;
+static pthread_once_t reactor_once = PTHREAD_ONCE_INIT;
+
+static void
+reactor_create()
+{
+	int n = 0;
+	const char *e = getenv("RPC_REACTOR_LOOPS");
+	if (e)
+		n = atoi(e);
+	if (n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n <= 0)
+		n = 1;
+	reactor_instance = new Reactor(n);
+}
+
+Reactor *
+Reactor::Instance()
+{
+	pthread_once(&reactor_once, reactor_create);
+	return reactor_instance;
+}
+
+Reactor::Reactor(int nloops) : next_loop_(0), stop_(false)
+{
+	VERIFY(pthread_mutex_init(&m_, NULL) == 0);
+	for (int i = 0; i < nloops; i++) {
+		event_loop *l = new event_loop;
+		l->id = i;
+		l->busy = false;
+		l->batches = 0;
+		VERIFY(pthread_mutex_init(&l->m, NULL) == 0);
+		VERIFY(pthread_cond_init(&l->batch_done_c, NULL) == 0);
+		l->epfd = epoll_create(64);
+		VERIFY(l->epfd >= 0);
+		l->wakefd = eventfd(0, EFD_NONBLOCK);
+		VERIFY(l->wakefd >= 0);
+
+		struct epoll_event ev;
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		VERIFY(epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->wakefd, &ev) == 0);
+		loops_.push_back(l);
+	}
+	for (unsigned i = 0; i < loops_.size(); i++)
+		loops_[i]->th = method_thread(thread_layout_place(THR_ROLE_REACTOR, i),
+				this, false, &Reactor::loop, loops_[i]);
+}
+
+Reactor::~Reactor()
+{
+	stop_ = true;
+	for (unsigned i = 0; i < loops_.size(); i++) {
+		uint64_t one = 1;
+		VERIFY(write(loops_[i]->wakefd, &one, sizeof(one)) == sizeof(one));
+		VERIFY(pthread_join(loops_[i]->th, NULL) == 0);
+	}
+	for (unsigned i = 0; i < loops_.size(); i++) {
+		event_loop *l = loops_[i];
+		for (unsigned j = 0; j < l->dead.size(); j++)
+			delete l->dead[j];
+		close(l->epfd);
+		close(l->wakefd);
+		VERIFY(pthread_mutex_destroy(&l->m) == 0);
+		VERIFY(pthread_cond_destroy(&l->batch_done_c) == 0);
+		delete l;
+	}
+	for (unsigned i = 0; i < fds_.size(); i++)
+		delete fds_[i];
+	VERIFY(pthread_mutex_destroy(&m_) == 0);
+}
+
+// caller holds e->loop->m
+void
+Reactor::watch(fdent *e, int op)
+{
+	struct epoll_event ev;
+	ev.events = EPOLLET;
+	if (e->flags & CB_RDONLY)
+		ev.events |= EPOLLIN;
+	if (e->flags & CB_WRONLY)
+		ev.events |= EPOLLOUT;
+	ev.data.ptr = e;
+	if (epoll_ctl(e->loop->epfd, op, e->fd, &ev) != 0)
+		jsl_log(JSL_DBG_1, "Reactor::watch epoll_ctl %d fd %d failed %d\n",
+				op, e->fd, errno);
+}
+
+// unregister e; caller holds m_ and e->loop->m, and has cleared fds_[fd].
+// the loop frees e once no batch can still refer to it.
+void
+Reactor::retire(fdent *e)
+{
+	if (epoll_ctl(e->loop->epfd, EPOLL_CTL_DEL, e->fd, NULL) != 0)
+		jsl_log(JSL_DBG_4, "Reactor::retire fd %d not watched %d\n", e->fd, errno);
+	e->flags = 0;
+	e->removed = true;
+	e->loop->dead.push_back(e);
+	uint64_t one = 1;
+	VERIFY(write(e->loop->wakefd, &one, sizeof(one)) == sizeof(one));
+}
+
+void
+Reactor::add_callback(int fd, poll_flag flag, aio_callback *ch)
+{
+	VERIFY(fd >= 0);
+	ScopedLock ml(&m_);
+	if ((unsigned) fd >= fds_.size())
+		fds_.resize(fd + 1, NULL);
+
+	fdent *e = fds_[fd];
+	if (!e) {
+		e = new fdent;
+		e->fd = fd;
+		e->flags = 0;
+		e->removed = false;
+		e->loop = loops_[next_loop_++ % loops_.size()];
+		fds_[fd] = e;
+	}
+
+	ScopedLock ll(&e->loop->m);
+	int op = e->flags ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	e->cb = ch;
+	e->flags |= (flag & CB_RDWR);
+	watch(e, op);
+}
+
+void
+Reactor::del_callback(int fd, poll_flag flag)
+{
+	ScopedLock ml(&m_);
+	if (fd < 0 || (unsigned) fd >= fds_.size() || !fds_[fd])
+		return;
+
+	fdent *e = fds_[fd];
+	ScopedLock ll(&e->loop->m);
+	e->flags &= ~flag;
+	if (e->flags) {
+		watch(e, EPOLL_CTL_MOD);
+	} else {
+		fds_[fd] = NULL;
+		retire(e);
+	}
+}
+
+bool
+Reactor::has_callback(int fd, poll_flag flag, aio_callback *ch)
+{
+	ScopedLock ml(&m_);
+	if (fd < 0 || (unsigned) fd >= fds_.size() || !fds_[fd])
+		return false;
+	fdent *e = fds_[fd];
+	ScopedLock ll(&e->loop->m);
+	return e->cb == ch && (e->flags & flag) == (flag & CB_RDWR);
+}
+
+int
+Reactor::loop_of(int fd)
+{
+	ScopedLock ml(&m_);
+	if (fd < 0 || (unsigned) fd >= fds_.size() || !fds_[fd])
+		return -1;
+	return fds_[fd]->loop->id;
+}
+
+// remove all callbacks for fd; once this returns no callback for fd is
+// running or will run, so the caller may free the aio_callback.
+void
+Reactor::block_remove_fd(int fd)
+{
+	event_loop *l;
+	{
+		ScopedLock ml(&m_);
+		if (fd < 0 || (unsigned) fd >= fds_.size() || !fds_[fd])
+			return;
+		fdent *e = fds_[fd];
+		fds_[fd] = NULL;
+		l = e->loop;
+		ScopedLock ll(&l->m);
+		retire(e);
+	}
+
+	// a callback removing its own fd must not wait for itself
+	if (pthread_equal(pthread_self(), l->th))
+		return;
+
+	ScopedLock ll(&l->m);
+	unsigned long b = l->batches;
+	while (l->busy && l->batches == b)
+		VERIFY(pthread_cond_wait(&l->batch_done_c, &l->m) == 0);
+}
+
+void
+Reactor::loop(event_loop *l)
+{
+	std::vector<struct epoll_event> ready(64);
+
+	while (1) {
+		int n = epoll_wait(l->epfd, &ready[0], ready.size(), -1);
+		if (n < 0) {
+			VERIFY(errno == EINTR);
+			continue;
+		}
+
+		ScopedLock ll(&l->m);
+		if (stop_)
+			break;
+		l->busy = true;
+		reactor_batches.add();
+		reactor_events.add(n);
+
+		for (int i = 0; i < n; i++) {
+			fdent *e = (fdent *) ready[i].data.ptr;
+			uint32_t evs = ready[i].events;
+			if (!e) {
+				uint64_t v;
+				while (read(l->wakefd, &v, sizeof(v)) > 0)
+					;
+				continue;
+			}
+
+			bool err = evs & (EPOLLERR | EPOLLHUP);
+			if (!e->removed && (e->flags & CB_RDONLY) && (err || (evs & EPOLLIN))) {
+				aio_callback *cb = e->cb;
+				VERIFY(pthread_mutex_unlock(&l->m) == 0);
+				cb->read_cb(e->fd);
+				VERIFY(pthread_mutex_lock(&l->m) == 0);
+			}
+			if (!e->removed && (e->flags & CB_WRONLY) && (err || (evs & EPOLLOUT))) {
+				aio_callback *cb = e->cb;
+				VERIFY(pthread_mutex_unlock(&l->m) == 0);
+				cb->write_cb(e->fd);
+				VERIFY(pthread_mutex_lock(&l->m) == 0);
+			}
+		}
+
+		for (unsigned i = 0; i < l->dead.size(); i++)
+			delete l->dead[i];
+		l->dead.clear();
+		l->busy = false;
+		l->batches++;
+		VERIFY(pthread_cond_broadcast(&l->batch_done_c) == 0);
+
+		if ((unsigned) n == ready.size())
+			ready.resize(ready.size() * 2);
+	}
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,75 @@
+#ifndef reactor_h
+#define reactor_h
+
+// multi-threaded edge-triggered epoll reactor.
+//
+// a drop-in for PollMgr without its MAX_POLL_FDS cap or single wait
+// thread. each fd is assigned to one of N event loops when it is first
+// registered and stays there until block_remove_fd(), so all callbacks
+// for one connection run on one thread, never concurrently. events are
+// edge-triggered: read_cb()/write_cb() must consume until EAGAIN.
+
+#ifdef __linux__
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <vector>
+
+#include "pollmgr.h"
+
+class Reactor {
+	public:
+		Reactor(int nloops);
+		~Reactor();
+
+		// RPC_REACTOR_LOOPS loops, default one per online cpu
+		static Reactor *Instance();
+
+		void add_callback(int fd, poll_flag flag, aio_callback *ch);
+		void del_callback(int fd, poll_flag flag);
+		bool has_callback(int fd, poll_flag flag, aio_callback *ch);
+		void block_remove_fd(int fd);
+
+		int nloops() { return loops_.size(); }
+		// loop an fd is assigned to, -1 if not registered
+		int loop_of(int fd);
+
+	private:
+		struct event_loop;
+
+		// per-fd registration, referenced from epoll_event.data.ptr.
+		// only freed by its loop between batches.
+		struct fdent {
+			int fd;
+			int flags;  // CB_RDONLY | CB_WRONLY currently watched
+			bool removed;
+			aio_callback *cb;
+			event_loop *loop;
+		};
+
+		struct event_loop {
+			int id;
+			int epfd;
+			int wakefd;  // eventfd, readable to break epoll_wait
+			pthread_t th;
+			pthread_mutex_t m;  // protects the fdents of this loop
+			pthread_cond_t batch_done_c;
+			bool busy;  // running callbacks of a batch
+			unsigned long batches;
+			std::vector<fdent *> dead;  // to free after this batch
+		};
+
+		void loop(event_loop *l);
+		void watch(fdent *e, int op);
+		void retire(fdent *e);
+
+		pthread_mutex_t m_;  // protects fds_ and next_loop_
+		std::vector<fdent *> fds_;  // indexed by fd, grown on demand
+		std::vector<event_loop *> loops_;
+		unsigned next_loop_;
+		bool stop_;
+};
+
+#endif /* __linux__ */
+
+#endif /* reactor_h */
@@ -0,0 +1,235 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "reply_window.h"
+#include "slab.h"
+#include "slock.h"
+#include "stats.h"
+
+static stat_counter rw_evictions("reply_window.evictions");
+static stat_counter rw_refused("reply_window.refused");
+static stat_counter rw_pruned("reply_window.pruned");
+
+reply_window::client::client() : acked(0), bytes(0), used(0), ring(RW_RING_MIN)
+{
+	for (unsigned i = 0; i < ring.size(); i++)
+		ring[i].state = NEW;
+}
+
+// the slot holding xid, or NULL
+reply_window::slot *
+reply_window::client::find(unsigned int xid)
+{
+	slot *s = &ring[xid & (ring.size() - 1)];
+	return (s->state != NEW && s->xid == xid) ? s : NULL;
+}
+
+void
+reply_window::client::forget(slot *s)
+{
+	if (s->state == DONE) {
+		slab_free(s->buf);
+		bytes -= s->sz;
+	}
+	s->state = NEW;
+	s->buf = NULL;
+	s->sz = 0;
+}
+
+void
+reply_window::client::forget_all()
+{
+	for (unsigned i = 0; i < ring.size(); i++)
+		if (ring[i].state != NEW)
+			forget(&ring[i]);
+}
+
+// whether an RPC of this client is still running
+bool
+reply_window::client::busy()
+{
+	for (unsigned i = 0; i < ring.size(); i++)
+		if (ring[i].state == INPROGRESS)
+			return true;
+	return false;
+}
+
+// the client has received every reply up to xid_rep
+void
+reply_window::client::ack(unsigned int xid_rep)
+{
+	if (xid_rep <= acked)
+		return;
+	if (xid_rep - acked < ring.size()) {
+		for (unsigned int x = acked + 1; x <= xid_rep; x++) {
+			slot *s = find(x);
+			if (s)
+				forget(s);
+		}
+	} else {
+		for (unsigned i = 0; i < ring.size(); i++)
+			if (ring[i].state != NEW && ring[i].xid <= xid_rep)
+				forget(&ring[i]);
+	}
+	acked = xid_rep;
+}
+
+// double the ring, e.g. when more xids are outstanding than it has slots
+void
+reply_window::client::grow()
+{
+	std::vector<slot> old(ring.size() * 2);
+	old.swap(ring);
+	for (unsigned i = 0; i < ring.size(); i++)
+		ring[i].state = NEW;
+	for (unsigned i = 0; i < old.size(); i++)
+		if (old[i].state != NEW)
+			ring[old[i].xid & (ring.size() - 1)] = old[i];
+}
+
+// drop the oldest cached replies until under RW_CLIENT_BYTES. the slots
+// stay as FORGOTTEN so retransmissions are not executed again.
+void
+reply_window::client::trim()
+{
+	while (bytes > RW_CLIENT_BYTES) {
+		slot *oldest = NULL;
+		for (unsigned i = 0; i < ring.size(); i++)
+			if (ring[i].state == DONE && (!oldest || ring[i].xid < oldest->xid))
+				oldest = &ring[i];
+		if (!oldest)
+			break;
+		slab_free(oldest->buf);
+		bytes -= oldest->sz;
+		oldest->buf = NULL;
+		oldest->sz = 0;
+		oldest->state = FORGOTTEN;
+		rw_evictions.add();
+	}
+}
+
+reply_window::reply_window()
+{
+	for (int i = 0; i < RW_SHARDS; i++)
+		VERIFY(pthread_mutex_init(&shards_[i].m, 0) == 0);
+}
+
+reply_window::~reply_window()
+{
+	clear();
+	for (int i = 0; i < RW_SHARDS; i++)
+		VERIFY(pthread_mutex_destroy(&shards_[i].m) == 0);
+}
+
+// drop the clients of sh idle for RW_CLIENT_IDLE_S; one that comes back
+// starts afresh, long after it gave up on those RPCs
+void
+reply_window::prune(shard &sh, time_t now)
+{
+	std::unordered_map<unsigned int, client *>::iterator i = sh.clients.begin();
+	while (i != sh.clients.end()) {
+		client *c = i->second;
+		if (now - c->used < RW_CLIENT_IDLE_S || c->busy()) {
+			++i;
+			continue;
+		}
+		c->forget_all();
+		delete c;
+		i = sh.clients.erase(i);
+		rw_pruned.add();
+	}
+}
+
+reply_window::state
+reply_window::check_and_update(unsigned int clt_nonce, unsigned int xid,
+		unsigned int xid_rep, char **b, int *sz)
+{
+	shard &sh = shard_of(clt_nonce);
+	ScopedLock ml(&sh.m);
+
+	time_t now = time(0);
+	std::unordered_map<unsigned int, client *>::iterator i = sh.clients.find(clt_nonce);
+	if (i == sh.clients.end()) {
+		if (sh.clients.size() >= RW_SHARD_CLIENTS)
+			prune(sh, now);
+		i = sh.clients.insert(std::make_pair(clt_nonce, new client)).first;
+	}
+	client *c = i->second;
+	c->used = now;
+	c->ack(xid_rep);
+	if (xid <= c->acked)
+		return FORGOTTEN;
+
+	slot *s = &c->ring[xid & (c->ring.size() - 1)];
+	if (s->state != NEW && s->xid == xid) {
+		if (s->state != DONE)
+			return (state) s->state;
+		*b = (char *) slab_alloc(s->sz);
+		VERIFY(*b);
+		memcpy(*b, s->buf, s->sz);
+		*sz = s->sz;
+		return DONE;
+	}
+
+	while (s->state != NEW) {
+		if (s->xid <= c->acked) {
+			// stale; ack() only clears the xids it steps over
+			c->forget(s);
+			break;
+		}
+		if (c->ring.size() < RW_RING_MAX) {
+			c->grow();
+			s = &c->ring[xid & (c->ring.size() - 1)];
+			continue;
+		}
+		if (s->state == INPROGRESS || s->xid > xid) {
+			// no room without losing a live or newer xid
+			rw_refused.add();
+			return s->state == INPROGRESS ? INPROGRESS : FORGOTTEN;
+		}
+		// evict the older xid; the client can't still want it
+		c->acked = s->xid;
+		c->forget(s);
+		rw_evictions.add();
+	}
+	s->xid = xid;
+	s->state = INPROGRESS;
+	s->buf = NULL;
+	s->sz = 0;
+	return NEW;
+}
+
+void
+reply_window::add_reply(unsigned int clt_nonce, unsigned int xid, char *b, int sz)
+{
+	shard &sh = shard_of(clt_nonce);
+	ScopedLock ml(&sh.m);
+
+	std::unordered_map<unsigned int, client *>::iterator i = sh.clients.find(clt_nonce);
+	slot *s = i == sh.clients.end() ? NULL : i->second->find(xid);
+	if (!s || s->state != INPROGRESS) {
+		// acknowledged (or the window was cleared) while in progress
+		slab_free(b);
+		return;
+	}
+	s->buf = b;
+	s->sz = sz;
+	s->state = DONE;
+	i->second->bytes += sz;
+	i->second->trim();
+}
+
+void
+reply_window::clear()
+{
+	for (int i = 0; i < RW_SHARDS; i++) {
+		ScopedLock ml(&shards_[i].m);
+		std::unordered_map<unsigned int, client *>::iterator j;
+		for (j = shards_[i].clients.begin(); j != shards_[i].clients.end(); ++j) {
+			client *c = j->second;
+			c->forget_all();
+			delete c;
+		}
+		shards_[i].clients.clear();
+	}
+}
@@ -0,0 +1,98 @@
+#ifndef reply_window_h
+#define reply_window_h
+
+// at-most-once state for rpcs: per client, the xids that are in progress
+// or whose replies the client has not yet acknowledged.
+//
+// clients are spread over RW_SHARDS independently locked hash tables by
+// clt_nonce. each client keeps a power-of-two ring indexed by xid, so a
+// duplicate check is one hash lookup and one slot probe. cached reply
+// bytes per client are capped at RW_CLIENT_BYTES; past that the oldest
+// replies are dropped and their retransmissions answered as FORGOTTEN.
+//
+// the ring grows to at most RW_RING_MAX slots. past that, an xid whose
+// slot holds an older finished one evicts it and every xid up to it
+// counts as acknowledged; one whose slot is still in progress is
+// answered as INPROGRESS, i.e. not run, until the client catches up.
+// a shard forgets clients idle for RW_CLIENT_IDLE_S once it holds
+// RW_SHARD_CLIENTS of them.
+
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+#include <unordered_map>
+#include <vector>
+
+enum {
+	RW_SHARDS = 64,
+	RW_RING_MIN = 16,
+	RW_RING_MAX = 4096,
+	RW_CLIENT_BYTES = 1 << 20,
+	RW_SHARD_CLIENTS = 256,
+	RW_CLIENT_IDLE_S = 120,
+};
+
+class reply_window {
+	public:
+		// same order as rpcs::rpcstate_t
+		enum state {
+			NEW,         // new RPC, not a duplicate
+			INPROGRESS,  // duplicate of an RPC we're still processing
+			DONE,        // duplicate of an RPC we already replied to
+			FORGOTTEN,   // duplicate of an old RPC whose reply we dropped
+		};
+
+		reply_window();
+		~reply_window();
+
+		// forget the replies to xids <= xid_rep, then classify xid. a NEW
+		// xid is recorded as in progress. for DONE, *b is a copy of the
+		// reply that the caller sends and releases with slab_free().
+		state check_and_update(unsigned int clt_nonce, unsigned int xid,
+				unsigned int xid_rep, char **b, int *sz);
+
+		// record the reply to xid, taking ownership of b. the caller must
+		// be done sending b: a duplicate arriving meanwhile is INPROGRESS.
+		void add_reply(unsigned int clt_nonce, unsigned int xid, char *b, int sz);
+
+		// drop all state, e.g. when the server restarts
+		void clear();
+
+	private:
+		struct slot {
+			unsigned int xid;
+			int state;  // INPROGRESS, DONE or FORGOTTEN; NEW means empty
+			char *buf;
+			int sz;
+		};
+
+		struct client {
+			client();
+			unsigned int acked;  // every xid <= acked is forgotten
+			size_t bytes;        // cached reply bytes
+			time_t used;         // last check_and_update()
+			std::vector<slot> ring;
+			slot *find(unsigned int xid);
+			void forget(slot *s);
+			void forget_all();
+			bool busy();
+			void ack(unsigned int xid_rep);
+			void grow();
+			void trim();
+		};
+
+		struct shard {
+			pthread_mutex_t m;
+			std::unordered_map<unsigned int, client *> clients;
+		} __attribute__((aligned(64)));
+
+		shard &shard_of(unsigned int clt_nonce) {
+			return shards_[(clt_nonce * 2654435761u) >> 26];
+		}
+
+		shard shards_[RW_SHARDS];
+
+		void prune(shard &sh, time_t now);
+};
+
+#endif
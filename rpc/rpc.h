@@ -5,11 +5,26 @@
 #include <netinet/in.h>
 #include <list>
 #include <map>
+#include <optional>
 #include <stdio.h>
+#include <string>
+#include <time.h>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "thr_pool.h"
+#include "coro.h"
 #include "marshall.h"
 #include "connection.h"
+#include "connpool.h"
+#include "rtt.h"
+#include "deadline.h"
+#include "lanes.h"
+#include "stats.h"
+#include "reply_window.h"
+#include "localconn.h"
 
 #ifdef DMALLOC
 #include "dmalloc.h"
@@ -18,6 +33,10 @@
 class rpc_const {
 	public:
 		static const unsigned int bind = 1;   // handler number reserved for bind
+		static const unsigned int stats = 2;  // handler number reserved for stats
+		static const unsigned int features = 3; // reserved for wire negotiation
+		// optional wire features, negotiated by rpcc::bind()
+		static const unsigned int feature_compact = 0x1;  // varints, see marshall.h
 		static const int timeout_failure = -1;
 		static const int unmarshal_args_failure = -2;
 		static const int unmarshal_reply_failure = -3;
@@ -25,12 +44,16 @@ class rpc_const {
 		static const int oldsrv_failure = -5;
 		static const int bind_failure = -6;
 		static const int cancel_failure = -7;
+		static const int deadline_failure = -8; // handler gave up, see deadline.h
+		static const int overload_failure = -9; // turned away, see lanes.h
+		static const int dispatch_min = 6;    // rpcs dispatch threads
+		static const int dispatch_max = 64;
 };
 
 // rpc client endpoint.
 // manages a xid space per destination socket
 // threaded: multiple threads can be sending RPCs,
-class rpcc : public chanmgr {
+class rpcc : public chanmgr, public connpool::connector {
 
 	private:
 
@@ -47,7 +70,8 @@ class rpcc : public chanmgr {
 			pthread_cond_t c;
 		};
 
-		void get_refconn(connection **ch);
+		// a referenced connection for xid's stream of chans_
+		void get_refconn(connection **ch, unsigned int xid);
 		void update_xid_rep(unsigned int xid);
 
 
@@ -60,10 +84,23 @@ class rpcc : public chanmgr {
 		bool retrans_;
 		bool reachable_;
 
-		connection *chan_;
+		// streams to dst_; calls are striped over them by xid
+		connpool chans_;
+
+		// round trips to dst_, for call1's retransmission timeouts
+		rtt_estimator rtt_;
+
+		// AF_UNIX path of a server on this host, or empty for TCP to
+		// dst_; connect() uses connect_local() when it is set.
+		std::string local_;
+		bool local_shm_;
+		connection *connect_local();
+
+		unsigned int want_features_ = 0; // asked for at bind()
+		unsigned int features_ = 0;      // what the server agreed to
 
 		pthread_mutex_t m_; // protect insert/delete to calls[]
-		pthread_mutex_t chan_m_;
+		pthread_mutex_t chan_m_; // protect local_, local_shm_
 
 		bool destroy_wait_;
 		pthread_cond_t destroy_wait_c_;
@@ -95,9 +132,30 @@ class rpcc : public chanmgr {
 		unsigned int id() { return clt_nonce_; }
 
 		int bind(TO to = to_max);
+		// agree on want_features_ with the server; bind() calls this
+		void negotiate(TO to);
 
 		void set_reachable(bool r) { reachable_ = r; }
 
+		// ask bind() to negotiate the compact encoding with the server
+		void set_compact(bool c) {
+			if (c)
+				want_features_ |= rpc_const::feature_compact;
+			else
+				want_features_ &= ~rpc_const::feature_compact;
+		}
+
+		// how many connections to spread calls over; call before bind().
+		void set_streams(int n) { chans_.set_size(n); }
+
+		// connpool::connector: open one more stream to the server
+		connection *connect();
+
+		// talk to a co-located rpcs through its listen_local() path;
+		// shm selects the shared-memory rings over the socket itself.
+		// call before bind().
+		void use_local(const std::string &path, bool shm=false);
+
 		void cancel();
                 
                 int islossy() { return lossytest_ > 0; }
@@ -111,33 +169,52 @@ class rpcc : public chanmgr {
 		template<class R>
 			int call_m(unsigned int proc, marshall &req, R & r, TO to);
 
-		template<class R>
-			int call(unsigned int proc, R & r, TO to = to_max); 
-		template<class R, class A1>
-			int call(unsigned int proc, const A1 & a1, R & r, TO to = to_max); 
-		template<class R, class A1, class A2>
-			int call(unsigned int proc, const A1 & a1, const A2 & a2, R & r, 
-					TO to = to_max); 
-		template<class R, class A1, class A2, class A3>
-			int call(unsigned int proc, const A1 & a1, const A2 & a2, const A3 & a3, 
-					R & r, TO to = to_max); 
-		template<class R, class A1, class A2, class A3, class A4>
-			int call(unsigned int proc, const A1 & a1, const A2 & a2, const A3 & a3, 
-					const A4 & a4, R & r, TO to = to_max);
-		template<class R, class A1, class A2, class A3, class A4, class A5>
-			int call(unsigned int proc, const A1 & a1, const A2 & a2, const A3 & a3, 
-					const A4 & a4, const A5 & a5, R & r, TO to = to_max); 
-		template<class R, class A1, class A2, class A3, class A4, class A5,
-			class A6>
-				int call(unsigned int proc, const A1 & a1, const A2 & a2, const A3 & a3, 
-						const A4 & a4, const A5 & a5, const A6 & a6,
-						R & r, TO to = to_max); 
-		template<class R, class A1, class A2, class A3, class A4, class A5, 
-			class A6, class A7>
-				int call(unsigned int proc, const A1 & a1, const A2 & a2, const A3 & a3, 
-						const A4 & a4, const A5 & a5, const A6 &a6, const A7 &a7,
-						R & r, TO to = to_max); 
+		// call(proc, a1, ..., an, r [, to]): marshal the arguments in
+		// order, forwarded straight into the marshall, and unmarshal the
+		// reply into r. to defaults to to_max.
+		template<class... Args>
+			int call(unsigned int proc, Args&&... args);
+
+#ifdef RPC_CORO
+		// completion of call1_async()
+		class async_done {
+			public:
+				virtual ~async_done() { }
+				// what call1() would have returned, rep filled in. runs
+				// on the poll thread, or the retransmit timer that gave
+				// up, so it must not block.
+				virtual void done(int intret) = 0;
+		};
+
+		// call1() without the wait: returns once req is on its way, and
+		// d->done() follows. req, rep and d must last until then.
+		void call1_async(unsigned int proc, marshall &req, unmarshall &rep,
+				TO to, async_done *d);
+
+		template<class R> class call_op;
+
+		// co_await acall(proc, a1, ..., an, r [, to]): call() for a
+		// coroutine, which is suspended rather than its thread blocked.
+		// the arguments are copied; r must outlive the call. resumes on
+		// rpc_coro_pool(), or the pool given to on().
+		template<class... Args>
+			auto acall(unsigned int proc, Args&&... args);
+#endif
+
+	private:
+		template<class T> struct is_to :
+			std::is_same<typename std::decay<T>::type, TO> { };
 
+		template<class Tuple>
+			static TO call_to(Tuple &t, std::true_type) {
+				return std::get<std::tuple_size<Tuple>::value - 1>(t);
+			}
+		template<class Tuple>
+			static TO call_to(Tuple &, std::false_type) { return to_max; }
+
+		template<class Tuple, class HasTO, size_t... I>
+			int call_args(unsigned int proc, Tuple &t, HasTO has_to,
+					std::index_sequence<I...>);
 };
 
 template<class R> int 
@@ -157,108 +234,160 @@ rpcc::call_m(unsigned int proc, marshall &req, R & r, TO to)
 	return intret;
 }
 
-template<class R> int
-rpcc::call(unsigned int proc, R & r, TO to) 
+template<class... Args> int
+rpcc::call(unsigned int proc, Args&&... args)
 {
-	marshall m;
-	return call_m(proc, m, r, to);
+	static_assert(sizeof...(Args) >= 1, "rpcc::call needs a reply argument");
+	typedef std::tuple<Args&&...> tuple_t;
+	typedef typename std::tuple_element<sizeof...(Args) - 1, tuple_t>::type last_t;
+	typedef std::integral_constant<bool, is_to<last_t>::value> has_to_t;
+
+	tuple_t t(std::forward<Args>(args)...);
+	return call_args(proc, t, has_to_t(),
+			std::make_index_sequence<sizeof...(Args) - 1 - has_to_t::value>());
 }
 
-template<class R, class A1> int
-rpcc::call(unsigned int proc, const A1 & a1, R & r, TO to) 
+template<class Tuple, class HasTO, size_t... I> int
+rpcc::call_args(unsigned int proc, Tuple &t, HasTO has_to,
+		std::index_sequence<I...>)
 {
 	marshall m;
-	m << a1;
-	return call_m(proc, m, r, to);
+	// the arguments outlive this synchronous call
+	m.refs_ok(true);
+	m.set_compact(features_ & rpc_const::feature_compact);
+	int unused[] = { 0, ((m << std::get<I>(t)), 0)... };
+	(void) unused;
+	return call_m(proc, m, std::get<sizeof...(I)>(t), call_to(t, has_to));
 }
 
-template<class R, class A1, class A2> int
-rpcc::call(unsigned int proc, const A1 & a1, const A2 & a2,
-		R & r, TO to) 
-{
-	marshall m;
-	m << a1;
-	m << a2;
-	return call_m(proc, m, r, to);
-}
+#ifdef RPC_CORO
+template<class R>
+class rpcc::call_op : public rpcc::async_done {
+	public:
+		template<class Tuple, size_t... I>
+			call_op(rpcc *cl, unsigned int proc, Tuple &t, TO to,
+					std::index_sequence<I...>)
+			: cl_(cl), proc_(proc), to_(to), r_(&std::get<sizeof...(I)>(t)),
+			pool_(NULL), intret_(0) {
+				req_.set_compact(cl->features_ & rpc_const::feature_compact);
+				int unused[] = { 0, ((req_ << std::get<I>(t)), 0)... };
+				(void) unused;
+			}
+		call_op(const call_op &) = delete;
+		call_op &operator=(const call_op &) = delete;
 
-template<class R, class A1, class A2, class A3> int
-rpcc::call(unsigned int proc, const A1 & a1, const A2 & a2,
-		const A3 & a3, R & r, TO to) 
-{
-	marshall m;
-	m << a1;
-	m << a2;
-	m << a3;
-	return call_m(proc, m, r, to);
-}
+		// resume the caller on pool
+		call_op &on(ThrPool *pool) { pool_ = pool; return *this; }
 
-template<class R, class A1, class A2, class A3, class A4> int
-rpcc::call(unsigned int proc, const A1 & a1, const A2 & a2,
-		const A3 & a3, const A4 & a4, R & r, TO to) 
-{
-	marshall m;
-	m << a1;
-	m << a2;
-	m << a3;
-	m << a4;
-	return call_m(proc, m, r, to);
-}
+		bool await_ready() { return false; }
+		void await_suspend(std::coroutine_handle<> h) {
+			h_ = h;
+			// done() may resume h before this returns
+			cl_->call1_async(proc_, req_, rep_, to_, this);
+		}
+		int await_resume() {
+			if (intret_ < 0)
+				return intret_;
+			rep_ >> *r_;
+			if (rep_.okdone() != true) {
+				fprintf(stderr, "rpcc::acall: failed to unmarshall the reply."
+						"You are probably calling RPC 0x%x with wrong return "
+						"type.\n", proc_);
+				VERIFY(0);
+				return rpc_const::unmarshal_reply_failure;
+			}
+			return intret_;
+		}
 
-template<class R, class A1, class A2, class A3, class A4, class A5> int
-rpcc::call(unsigned int proc, const A1 & a1, const A2 & a2,
-		const A3 & a3, const A4 & a4, const A5 & a5, R & r, TO to) 
-{
-	marshall m;
-	m << a1;
-	m << a2;
-	m << a3;
-	m << a4;
-	m << a5;
-	return call_m(proc, m, r, to);
-}
+		void done(int intret) {
+			intret_ = intret;
+			rpc_resume(h_, pool_);
+		}
 
-template<class R, class A1, class A2, class A3, class A4, class A5,
-	class A6> int
-rpcc::call(unsigned int proc, const A1 & a1, const A2 & a2,
-		const A3 & a3, const A4 & a4, const A5 & a5, 
-		const A6 & a6, R & r, TO to) 
-{
-	marshall m;
-	m << a1;
-	m << a2;
-	m << a3;
-	m << a4;
-	m << a5;
-	m << a6;
-	return call_m(proc, m, r, to);
-}
+	private:
+		rpcc *cl_;
+		unsigned int proc_;
+		TO to_;
+		R *r_;
+		ThrPool *pool_;
+		int intret_;
+		marshall req_;
+		unmarshall rep_;
+		std::coroutine_handle<> h_;
+};
 
-template<class R, class A1, class A2, class A3, class A4, class A5,
-	class A6, class A7> int
-rpcc::call(unsigned int proc, const A1 & a1, const A2 & a2,
-		const A3 & a3, const A4 & a4, const A5 & a5, 
-		const A6 & a6, const A7 & a7,
-		R & r, TO to) 
+template<class... Args> auto
+rpcc::acall(unsigned int proc, Args&&... args)
 {
-	marshall m;
-	m << a1;
-	m << a2;
-	m << a3;
-	m << a4;
-	m << a5;
-	m << a6;
-	m << a7;
-	return call_m(proc, m, r, to);
+	static_assert(sizeof...(Args) >= 1, "rpcc::acall needs a reply argument");
+	typedef std::tuple<Args&&...> tuple_t;
+	typedef typename std::tuple_element<sizeof...(Args) - 1, tuple_t>::type last_t;
+	typedef std::integral_constant<bool, is_to<last_t>::value> has_to_t;
+	typedef typename std::decay<typename std::tuple_element<
+		sizeof...(Args) - 1 - has_to_t::value, tuple_t>::type>::type reply_t;
+
+	tuple_t t(std::forward<Args>(args)...);
+	return call_op<reply_t>(this, proc, t, call_to(t, has_to_t()),
+			std::make_index_sequence<sizeof...(Args) - 1 - has_to_t::value>());
 }
+#endif
 
 bool operator<(const sockaddr_in &a, const sockaddr_in &b);
 
+// proc number -> E *, read without locks. procs are grouped by protocol
+// base (proc & ~0xff) into pages of 256 slots allocated on first use;
+// slots are only ever filled, by writers serialized by their own lock.
+template<class E>
+class proc_table {
+	public:
+		enum {
+			PAGE_BITS = 8,
+			PAGE_SZ = 1 << PAGE_BITS,
+			PAGES = 1 << (16 - PAGE_BITS),
+		};
+
+		proc_table() { memset(pages_, 0, sizeof(pages_)); }
+		~proc_table() {
+			for (int i = 0; i < PAGES; i++)
+				delete [] pages_[i];
+		}
+
+		E *get(unsigned int proc) {
+			if (proc >> 16)
+				return NULL;
+			E **page = __atomic_load_n(&pages_[proc >> PAGE_BITS], __ATOMIC_ACQUIRE);
+			if (!page)
+				return NULL;
+			return __atomic_load_n(&page[proc & (PAGE_SZ - 1)], __ATOMIC_ACQUIRE);
+		}
+
+		bool put(unsigned int proc, E *e) {
+			if (proc >> 16)
+				return false;
+			E **page = pages_[proc >> PAGE_BITS];
+			if (!page) {
+				page = new E *[PAGE_SZ]();
+				__atomic_store_n(&pages_[proc >> PAGE_BITS], page, __ATOMIC_RELEASE);
+			}
+			__atomic_store_n(&page[proc & (PAGE_SZ - 1)], e, __ATOMIC_RELEASE);
+			return true;
+		}
+
+	private:
+		E **pages_[PAGES];
+};
+
 class handler {
 	public:
 		handler() { }
 		virtual ~handler() { }
 		virtual int fn(unmarshall &, marshall &) = 0;
+		// for handlers that can finish later (reg_async): run without
+		// holding the calling thread, and call done(arg, ret) once the
+		// reply is in the marshall, from any thread, possibly before
+		// start() returns. false if this handler only has fn().
+		virtual bool start(unmarshall &, marshall &,
+				void (*)(void *, int), void *) { return false; }
 };
 
 
@@ -274,30 +403,14 @@ class rpcs : public chanmgr {
 
 	private:
 
-        // state about an in-progress or completed RPC, for at-most-once.
-        // if cb_present is true, then the RPC is complete and a reply
-        // has been sent; in that case buf points to a copy of the reply,
-        // and sz holds the size of the reply.
-	struct reply_t {
-		reply_t (unsigned int _xid) {
-			xid = _xid;
-			cb_present = false;
-			buf = NULL;
-			sz = 0;
-		}
-		unsigned int xid;
-		bool cb_present; // whether the reply buffer is valid
-		char *buf;      // the reply buffer
-		int sz;         // the size of reply buffer
-	};
-
 	int port_;
 	unsigned int nonce_;
 
 	// provide at most once semantics by maintaining a window of replies
 	// per client that that client hasn't acknowledged receiving yet.
-        // indexed by client nonce.
-	std::map<unsigned int, std::list<reply_t> > reply_window_;
+	// sharded by client nonce with its own locks; the methods below
+	// delegate to it.
+	reply_window reply_window_;
 
 	void free_reply_window(void);
 	void add_reply(unsigned int clt_nonce, unsigned int xid, char *b, int sz);
@@ -322,27 +435,85 @@ class rpcs : public chanmgr {
 	// map proc # to function
 	std::map<int, handler *> procs_;
 
+	// per-proc histograms, created by reg1(); dispatch() finds them
+	// through proc_tab_.
+	struct proc_stats {
+		proc_stats(unsigned int proc);
+		histogram queue_ns;   // arrival to start of dispatch
+		histogram handler_ns; // time in the handler
+		histogram reply_sz;   // reply bytes
+	};
+	std::map<int, proc_stats *> pstats_;
+
+	// what dispatch() needs per proc, filled in by reg1() under procs_m_
+	// and looked up without locks
+	struct proc_entry {
+		handler *h;
+		proc_stats *ps;
+		int lane;  // rpc_lane, LANE_NORMAL unless set_lane()
+	};
+	proc_table<proc_entry> proc_tab_;
+
 	pthread_mutex_t procs_m_; // protect insert/delete to procs[]
 	pthread_mutex_t count_m_;  //protect modification of counts
-	pthread_mutex_t reply_window_m_; // protect reply window et al
 	pthread_mutex_t conss_m_; // protect conns_
 
 
 	protected:
 
-	struct djob_t {
-		djob_t (connection *c, char *b, int bsz):buf(b),sz(bsz),conn(c) {}
+	// from the slabs, like the PDU it carries
+	struct djob_t : public slab_object {
+		djob_t (connection *c, char *b, int bsz):buf(b),sz(bsz),conn(c) {
+			clock_gettime(CLOCK_MONOTONIC, &arrive);
+			deadline.tv_sec = deadline.tv_nsec = 0;
+		}
 		char *buf;
 		int sz;
 		connection *conn;
+		struct timespec arrive;
+		struct timespec deadline; // arrive + h.deadline_ms; 0 if none
 	};
 	void dispatch(djob_t *);
 
+	// dispatch() calls this once it has the header, before the duplicate
+	// check: sets j->deadline and says whether it has already passed,
+	// in which case nobody is waiting for the reply and j is dropped.
+	bool expired(djob_t *j, const req_header &h);
+
+	// requests wait here by priority lane and client; each
+	// dispatchpool_ job runs whichever queued request lanes_ picks, not
+	// a particular one
+	dispatch_lanes lanes_;
+	// got_pdu() hands every request to admit(), which queues it on its
+	// proc's lane and adds a pool job, or answers it at once with
+	// overload_failure (sent from a pool thread, see reject()). either
+	// way it takes over j.
+	void admit(djob_t *j);
+	void run_lane(dispatch_lanes *l);
+	void reject(djob_t *j, const req_header &h, bool compact);
+
+	proc_stats *add_proc_stats(unsigned int proc);
+
+	// called by reg1() with procs_m_ held
+	void add_proc(unsigned int proc, handler *h) {
+		proc_entry *e = new proc_entry;
+		e->h = h;
+		e->ps = add_proc_stats(proc);
+		e->lane = LANE_NORMAL;
+		VERIFY(proc_tab_.put(proc, e));
+	}
+	void record_proc_stats(proc_stats *ps, const djob_t *j,
+			const struct timespec &start, const struct timespec &end,
+			int rep_sz);
+
 	// internal handler registration
 	void reg1(unsigned int proc, handler *);
 
+	// work-stealing; rpcs sizes it between rpc_const::dispatch_min and
+	// dispatch_max threads so a slow handler doesn't starve the rest
 	ThrPool* dispatchpool_;
 	tcpsconn* listener_;
+	std::vector<unixsconn *> local_listeners_;
 
 	public:
 	rpcs(unsigned int port, int counts=0);
@@ -351,269 +522,152 @@ class rpcs : public chanmgr {
 	//RPC handler for clients binding
 	int rpcbind(int a, int &r);
 
+	//RPC handler for rpc_const::stats: every counter and histogram,
+	//then each client's queue depth and wait
+	int rpcstats(int a, std::string &r);
+
+	//RPC handler for rpc_const::features: the subset of want we speak
+	int rpcfeatures(unsigned int want, unsigned int &have);
+
+	// schedule proc's requests on lane (rpc_lane); after reg()
+	void set_lane(unsigned int proc, int lane);
+	dispatch_lanes &lanes() { return lanes_; }
+
 	void set_reachable(bool r) { reachable_ = r; }
 
+	// also accept clients on an AF_UNIX path (stream or shared memory,
+	// see localconn.h); the TCP port keeps working.
+	void listen_local(const std::string &path);
+
 	bool got_pdu(connection *c, char *b, int sz);
 
-	// register a handler
-	template<class S, class A1, class R>
-		void reg(unsigned int proc, S*, int (S::*meth)(const A1 a1, R & r));
-	template<class S, class A1, class A2, class R>
-		void reg(unsigned int proc, S*, int (S::*meth)(const A1 a1, const A2, 
-					R & r));
-	template<class S, class A1, class A2, class A3, class R>
-		void reg(unsigned int proc, S*, int (S::*meth)(const A1, const A2, 
-					const A3, R & r));
-	template<class S, class A1, class A2, class A3, class A4, class R>
-		void reg(unsigned int proc, S*, int (S::*meth)(const A1, const A2, 
-					const A3, const A4, R & r));
-	template<class S, class A1, class A2, class A3, class A4, class A5, class R>
-		void reg(unsigned int proc, S*, int (S::*meth)(const A1, const A2, 
-					const A3, const A4, const A5, 
-					R & r));
-	template<class S, class A1, class A2, class A3, class A4, class A5, class A6,
-		class R>
-			void reg(unsigned int proc, S*, int (S::*meth)(const A1, const A2, 
-						const A3, const A4, const A5, 
-						const A6, R & r));
-	template<class S, class A1, class A2, class A3, class A4, class A5, class A6,
-		class A7, class R>
-			void reg(unsigned int proc, S*, int (S::*meth)(const A1, const A2, 
-						const A3, const A4, const A5, 
-						const A6, const A7,
-						R & r));
+	// register a handler: int S::meth(A1, ..., An, R &r)
+	template<class S, class... P>
+		void reg(unsigned int proc, S*, int (S::*meth)(P...));
+
+#ifdef RPC_CORO
+	// register a coroutine handler: rpc_task<int> S::meth(A1, ..., An, R &r)
+	template<class S, class... P>
+		void reg_async(unsigned int proc, S*, rpc_task<int> (S::*meth)(P...));
+#endif
 };
 
-template<class S, class A1, class R> void
-rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(const A1 a1, R & r))
-{
-	class h1 : public handler {
-		private:
-			S * sob;
-			int (S::*meth)(const A1 a1, R & r);
-		public:
-			h1(S *xsob, int (S::*xmeth)(const A1 a1, R & r))
-				: sob(xsob), meth(xmeth) { }
-			int fn(unmarshall &args, marshall &ret) {
-				A1 a1;
-				R r;
-				args >> a1;
+template<class S, class... P>
+class method_handler : public handler {
+	private:
+		typedef std::tuple<typename std::decay<P>::type...> args_t;
+		static const size_t nargs = sizeof...(P) - 1;
+
+		S *sob;
+		int (S::*meth)(P...);
+
+		template<size_t... I>
+			int call(unmarshall &args, marshall &ret, std::index_sequence<I...>) {
+				args_t a;
+				// braced lists evaluate left to right
+				int unused[] = { 0, ((args >> std::get<I>(a)), 0)... };
+				(void) unused;
 				if(!args.okdone())
 					return rpc_const::unmarshal_args_failure;
-				int b = (sob->*meth)(a1, r);
-				ret << r;
+				int b = (sob->*meth)(std::get<I>(a)..., std::get<nargs>(a));
+				ret << std::get<nargs>(a);
 				return b;
 			}
-	};
-	reg1(proc, new h1(sob, meth));
-}
 
-template<class S, class A1, class A2, class R> void
-rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-			R & r))
-{
-	class h1 : public handler {
-		private:
-			S * sob;
-			int (S::*meth)(const A1 a1, const A2 a2, R & r);
-		public:
-			h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, R & r))
-				: sob(xsob), meth(xmeth) { }
-			int fn(unmarshall &args, marshall &ret) {
-				A1 a1;
-				A2 a2;
-				R r;
-				args >> a1;
-				args >> a2;
-				if(!args.okdone())
-					return rpc_const::unmarshal_args_failure;
-				int b = (sob->*meth)(a1, a2, r);
-				ret << r;
-				return b;
-			}
-	};
-	reg1(proc, new h1(sob, meth));
-}
+	public:
+		method_handler(S *xsob, int (S::*xmeth)(P...))
+			: sob(xsob), meth(xmeth) { }
+		int fn(unmarshall &args, marshall &ret) {
+			return call(args, ret, std::make_index_sequence<nargs>());
+		}
+};
 
-template<class S, class A1, class A2, class A3, class R> void
-rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-			const A3 a3, R & r))
+template<class S, class... P> void
+rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(P...))
 {
-	class h1 : public handler {
-		private:
-			S * sob;
-			int (S::*meth)(const A1 a1, const A2 a2, const A3 a3, R & r);
-		public:
-			h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, const A3 a3, R & r))
-				: sob(xsob), meth(xmeth) { }
-			int fn(unmarshall &args, marshall &ret) {
-				A1 a1;
-				A2 a2;
-				A3 a3;
-				R r;
-				args >> a1;
-				args >> a2;
-				args >> a3;
-				if(!args.okdone())
-					return rpc_const::unmarshal_args_failure;
-				int b = (sob->*meth)(a1, a2, a3, r);
-				ret << r;
-				return b;
-			}
-	};
-	reg1(proc, new h1(sob, meth));
+	static_assert(sizeof...(P) >= 1, "rpc handlers take a reply argument");
+	reg1(proc, new method_handler<S, P...>(sob, meth));
 }
 
-template<class S, class A1, class A2, class A3, class A4, class R> void
-rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-			const A3 a3, const A4 a4, 
-			R & r))
-{
-	class h1 : public handler {
-		private:
-			S * sob;
-			int (S::*meth)(const A1 a1, const A2 a2, const A3 a3, const A4 a4, R & r);
-		public:
-			h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, const A3 a3, 
-						const A4 a4, R & r))
-				: sob(xsob), meth(xmeth)  { }
-			int fn(unmarshall &args, marshall &ret) {
-				A1 a1;
-				A2 a2;
-				A3 a3;
-				A4 a4;
-				R r;
-				args >> a1;
-				args >> a2;
-				args >> a3;
-				args >> a4;
-				if(!args.okdone())
-					return rpc_const::unmarshal_args_failure;
-				int b = (sob->*meth)(a1, a2, a3, a4, r);
-				ret << r;
-				return b;
-			}
-	};
-	reg1(proc, new h1(sob, meth));
-}
+#ifdef RPC_CORO
+template<class S, class... P>
+class async_method_handler : public handler {
+	private:
+		typedef std::tuple<typename std::decay<P>::type...> args_t;
+		static const size_t nargs = sizeof...(P) - 1;
+
+		S *sob;
+		rpc_task<int> (S::*meth)(P...);
+
+		// a running call: the coroutine refers to a until it finishes
+		struct job {
+			args_t a;
+			std::optional<rpc_task<int> > t;
+			marshall *ret;
+			void (*done)(void *, int);
+			void *arg;
+		};
 
-template<class S, class A1, class A2, class A3, class A4, class A5, class R> void
-rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-			const A3 a3, const A4 a4, 
-			const A5 a5, R & r))
-{
-	class h1 : public handler {
-		private:
-			S * sob;
-			int (S::*meth)(const A1 a1, const A2 a2, const A3 a3, const A4 a4, 
-					const A5 a5, R & r);
-		public:
-			h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, const A3 a3, 
-						const A4 a4, const A5 a5, R & r))
-				: sob(xsob), meth(xmeth) { }
-			int fn(unmarshall &args, marshall &ret) {
-				A1 a1;
-				A2 a2;
-				A3 a3;
-				A4 a4;
-				A5 a5;
-				R r;
-				args >> a1;
-				args >> a2;
-				args >> a3;
-				args >> a4;
-				args >> a5;
-				if(!args.okdone())
-					return rpc_const::unmarshal_args_failure;
-				int b = (sob->*meth)(a1, a2, a3, a4, a5, r);
-				ret << r;
-				return b;
+		template<size_t... I>
+			job *unpack(unmarshall &args, std::index_sequence<I...>) {
+				job *j = new job;
+				int unused[] = { 0, ((args >> std::get<I>(j->a)), 0)... };
+				(void) unused;
+				if(!args.okdone()) {
+					delete j;
+					return NULL;
+				}
+				j->t.emplace((sob->*meth)(std::get<I>(j->a)..., std::get<nargs>(j->a)));
+				return j;
 			}
-	};
-	reg1(proc, new h1(sob, meth));
-}
 
-template<class S, class A1, class A2, class A3, class A4, class A5, class A6, class R> void
-rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-			const A3 a3, const A4 a4, 
-			const A5 a5, const A6 a6, 
-			R & r))
-{
-	class h1 : public handler {
-		private:
-			S * sob;
-			int (S::*meth)(const A1 a1, const A2 a2, const A3 a3, const A4 a4, 
-					const A5 a5, const A6 a6, R & r);
-		public:
-			h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, const A3 a3, 
-						const A4 a4, const A5 a5, const A6 a6, R & r))
-				: sob(xsob), meth(xmeth) { }
-			int fn(unmarshall &args, marshall &ret) {
-				A1 a1;
-				A2 a2;
-				A3 a3;
-				A4 a4;
-				A5 a5;
-				A6 a6;
-				R r;
-				args >> a1;
-				args >> a2;
-				args >> a3;
-				args >> a4;
-				args >> a5;
-				args >> a6;
-				if(!args.okdone())
-					return rpc_const::unmarshal_args_failure;
-				int b = (sob->*meth)(a1, a2, a3, a4, a5, a6, r);
-				ret << r;
-				return b;
+		static void finish(void *a) {
+			job *j = (job *) a;
+			int b = j->t->result();
+			*j->ret << std::get<nargs>(j->a);
+			void (*done)(void *, int) = j->done;
+			void *arg = j->arg;
+			delete j;
+			done(arg, b);
+		}
+
+	public:
+		async_method_handler(S *xsob, rpc_task<int> (S::*xmeth)(P...))
+			: sob(xsob), meth(xmeth) { }
+
+		// for a dispatcher that waits: holds its thread throughout
+		int fn(unmarshall &args, marshall &ret) {
+			job *j = unpack(args, std::make_index_sequence<nargs>());
+			if (!j)
+				return rpc_const::unmarshal_args_failure;
+			int b = rpc_sync_wait(*j->t);
+			ret << std::get<nargs>(j->a);
+			delete j;
+			return b;
+		}
+
+		bool start(unmarshall &args, marshall &ret,
+				void (*done)(void *, int), void *arg) {
+			job *j = unpack(args, std::make_index_sequence<nargs>());
+			if (!j) {
+				done(arg, rpc_const::unmarshal_args_failure);
+				return true;
 			}
-	};
-	reg1(proc, new h1(sob, meth));
-}
+			j->ret = &ret;
+			j->done = done;
+			j->arg = arg;
+			j->t->start(&finish, j);
+			return true;
+		}
+};
 
-template<class S, class A1, class A2, class A3, class A4, class A5, 
-	class A6, class A7, class R> void
-rpcs::reg(unsigned int proc, S*sob, int (S::*meth)(const A1 a1, const A2 a2, 
-			const A3 a3, const A4 a4, 
-			const A5 a5, const A6 a6,
-			const A7 a7, R & r))
+template<class S, class... P> void
+rpcs::reg_async(unsigned int proc, S*sob, rpc_task<int> (S::*meth)(P...))
 {
-	class h1 : public handler {
-		private:
-			S * sob;
-			int (S::*meth)(const A1 a1, const A2 a2, const A3 a3, const A4 a4, 
-					const A5 a5, const A6 a6, const A7 a7, R & r);
-		public:
-			h1(S *xsob, int (S::*xmeth)(const A1 a1, const A2 a2, const A3 a3, 
-						const A4 a4, const A5 a5, const A6 a6,
-						const A7 a7, R & r))
-				: sob(xsob), meth(xmeth) { }
-			int fn(unmarshall &args, marshall &ret) {
-				A1 a1;
-				A2 a2;
-				A3 a3;
-				A4 a4;
-				A5 a5;
-				A6 a6;
-				A7 a7;
-				R r;
-				args >> a1;
-				args >> a2;
-				args >> a3;
-				args >> a4;
-				args >> a5;
-				args >> a6;
-				args >> a7;
-				if(!args.okdone())
-					return rpc_const::unmarshal_args_failure;
-				int b = (sob->*meth)(a1, a2, a3, a4, a5, a6, a7, r);
-				ret << r;
-				return b;
-			}
-	};
-	reg1(proc, new h1(sob, meth));
+	static_assert(sizeof...(P) >= 1, "rpc handlers take a reply argument");
+	reg1(proc, new async_method_handler<S, P...>(sob, meth));
 }
+#endif
 
 
 void make_sockaddr(const char *hostandport, struct sockaddr_in *dst);
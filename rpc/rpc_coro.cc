@@ -0,0 +1,91 @@
+// where coroutines carry on after an rpcc::acall(); see coro.h. empty
+// unless the compiler supports coroutines.
+
+#include "rpc.h"
+
+#ifdef RPC_CORO
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fifo.h"
+#include "method_thread.h"
+#include "stats.h"
+
+static stat_counter coro_resumes("coro.resumes");
+static stat_counter coro_overflow("coro.resumes_overflow");
+
+static ThrPool *coro_pool;
+static pthread_once_t coro_once = PTHREAD_ONCE_INIT;
+
+// a few threads per core: coroutines only hold one while they run
+static void
+coro_pool_create()
+{
+	int n = 0;
+	const char *e = getenv("RPC_CORO_THREADS");
+	if (e)
+		n = atoi(e);
+	if (n <= 0)
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n <= 0)
+		n = 1;
+	// never blocks the poll thread handing it work
+	coro_pool = new ThrPool(n, 4 * n, false);
+}
+
+ThrPool *
+rpc_coro_pool()
+{
+	pthread_once(&coro_once, coro_pool_create);
+	return coro_pool;
+}
+
+class coro_resumer {
+	public:
+		void resume(void *a) {
+			std::coroutine_handle<>::from_address(a).resume();
+		}
+};
+
+static coro_resumer resumer;
+
+// coroutines a pool had no room for. the thread that resumes them is
+// started the first time one overflows; like coro_pool it lives on.
+static fifo<void *> *overflow;
+static pthread_once_t overflow_once = PTHREAD_ONCE_INIT;
+
+class coro_overflow_loop {
+	public:
+		void run() {
+			while (1) {
+				void *a;
+				overflow->deq(&a);
+				resumer.resume(a);
+			}
+		}
+};
+
+static coro_overflow_loop overflow_loop;
+
+static void
+overflow_create()
+{
+	overflow = new fifo<void *>();
+	method_thread(&overflow_loop, true, &coro_overflow_loop::run);
+}
+
+void
+rpc_resume(std::coroutine_handle<> h, ThrPool *pool)
+{
+	if (!pool)
+		pool = rpc_coro_pool();
+	coro_resumes.add();
+	if (pool->addObjJob(&resumer, &coro_resumer::resume, h.address()))
+		return;
+	coro_overflow.add();
+	pthread_once(&overflow_once, overflow_create);
+	overflow->enq(h.address());
+}
+
+#endif
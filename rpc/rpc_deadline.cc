@@ -0,0 +1,71 @@
+// deadlines: rpcs turns a request's deadline_ms into a CLOCK_MONOTONIC
+// deadline, drops requests that expired in the queue, and exposes the
+// deadline to the handler through deadline.h.
+
+#include "rpc.h"
+#include "stats.h"
+#include "jsl_log.h"
+
+static stat_counter expired_drops("rpcs.expired");
+
+static __thread const struct timespec *cur_deadline;
+
+static bool
+passed(const struct timespec &d, const struct timespec &now)
+{
+	return now.tv_sec > d.tv_sec ||
+		(now.tv_sec == d.tv_sec && now.tv_nsec >= d.tv_nsec);
+}
+
+rpc_deadline_scope::rpc_deadline_scope(const struct timespec &d)
+	: saved_(cur_deadline)
+{
+	cur_deadline = d.tv_sec ? &d : NULL;
+}
+
+rpc_deadline_scope::~rpc_deadline_scope()
+{
+	cur_deadline = saved_;
+}
+
+bool
+rpc_deadline_expired()
+{
+	if (!cur_deadline)
+		return false;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return passed(*cur_deadline, now);
+}
+
+int
+rpc_deadline_remaining_ms()
+{
+	if (!cur_deadline)
+		return -1;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (passed(*cur_deadline, now))
+		return 0;
+	return (cur_deadline->tv_sec - now.tv_sec) * 1000 +
+		(cur_deadline->tv_nsec - now.tv_nsec) / 1000000;
+}
+
+bool
+rpcs::expired(djob_t *j, const req_header &h)
+{
+	if (h.deadline_ms <= 0)
+		return false;
+	uint64_t ns = j->arrive.tv_nsec + (uint64_t) h.deadline_ms * 1000000;
+	j->deadline.tv_sec = j->arrive.tv_sec + ns / 1000000000;
+	j->deadline.tv_nsec = ns % 1000000000;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!passed(j->deadline, now))
+		return false;
+	expired_drops.add();
+	jsl_log(JSL_DBG_2, "rpcs::expired: dropping xid %d from %u, %d ms budget\n",
+			h.xid, h.clt_nonce, h.deadline_ms);
+	return true;
+}
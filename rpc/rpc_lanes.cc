@@ -0,0 +1,108 @@
+// rpcs admission: requests queue per priority lane and client
+// (lanes.h) rather than straight on dispatchpool_, and are refused once
+// a lane or a client backs up.
+
+#include "rpc.h"
+#include "slock.h"
+#include "stats.h"
+#include "jsl_log.h"
+
+static stat_counter reject_drops("rpcs.reject_drops");
+
+// sends overload_failure replies off the poll thread: admit() runs
+// there, and a blocking send to a slow or backed-up client would stall
+// every connection just when the server is busiest. shared by all
+// rpcs; a reply that finds its queue full is dropped, and the caller
+// retransmits or times out as if the request had been lost.
+static ThrPool *reject_pool;
+static pthread_once_t reject_once = PTHREAD_ONCE_INIT;
+
+static void
+reject_pool_create()
+{
+	reject_pool = new ThrPool(1, 2, false);
+}
+
+struct reject_reply : public slab_object {
+	connection *conn;
+	marshall rep;
+
+	void send(int) {
+		conn->send(rep.cstr(), rep.size());
+		conn->decref();
+		delete this;
+	}
+};
+
+void
+rpcs::set_lane(unsigned int proc, int lane)
+{
+	VERIFY(lane >= 0 && lane < LANE_COUNT);
+	ScopedLock pl(&procs_m_);
+	proc_entry *e = proc_tab_.get(proc);
+	VERIFY(e);
+	__atomic_store_n(&e->lane, lane, __ATOMIC_RELAXED);
+}
+
+void
+rpcs::admit(djob_t *j)
+{
+	// peek at the header; dispatch() parses it again
+	unmarshall u(j->buf, j->sz);
+	req_header h;
+	u.unpack_req_header(&h);
+	bool compact = u.compact();
+	char *b;
+	int sz;
+	u.take_buf(&b, &sz);
+
+	int lane = LANE_NORMAL;
+	proc_entry *e = u.ok() ? proc_tab_.get(h.proc) : NULL;
+	if (e)
+		lane = __atomic_load_n(&e->lane, __ATOMIC_RELAXED);
+
+	if (!lanes_.admit(lane, h.clt_nonce, j, j->sz, j->arrive)) {
+		reject(j, h, compact);
+		return;
+	}
+	// lanes hold fewer jobs than the pool's queue limit, so this
+	// never blocks the poll thread. it fails only once the pool is
+	// stopping: take j back, unless a running job already took it
+	if (!dispatchpool_->addObjJob(this, &rpcs::run_lane, &lanes_) &&
+			lanes_.withdraw(lane, h.clt_nonce, j))
+		reject(j, h, compact);
+}
+
+// runs the next request, then any that the per-client cap held back
+// while this job's turn went unused
+void
+rpcs::run_lane(dispatch_lanes *l)
+{
+	unsigned int clt;
+	djob_t *j = (djob_t *) l->next(&clt);
+	while (j) {
+		dispatch(j);
+		j = (djob_t *) l->done(clt, &clt);
+	}
+}
+
+// answer without running the handler or touching the reply window, so
+// a later retransmission of the xid is a new request
+void
+rpcs::reject(djob_t *j, const req_header &h, bool compact)
+{
+	jsl_log(JSL_DBG_2, "rpcs::reject: proc %x xid %d from %u overloaded\n",
+			h.proc, h.xid, h.clt_nonce);
+	pthread_once(&reject_once, reject_pool_create);
+	reject_reply *r = new reject_reply;
+	r->conn = j->conn;  // takes j's reference
+	r->rep.set_compact(compact);
+	r->rep.pack_reply_header(reply_header(h.xid, rpc_const::overload_failure));
+	slab_free(j->buf);
+	delete j;
+	if (!reject_pool->addObjJob(r, &reject_reply::send, 0)) {
+		reject_drops.add();
+		r->conn->decref();
+		delete r;
+	}
+}
@@ -0,0 +1,48 @@
+// how rpcc and rpcs reach each other: TCP, or for peers on the same
+// host AF_UNIX and shared memory (localconn.h). rpcc opens each stream
+// of its connpool through connect().
+
+#include "rpc.h"
+#include "slock.h"
+
+void
+rpcc::use_local(const std::string &path, bool shm)
+{
+	ScopedLock ml(&chan_m_);
+	local_ = path;
+	local_shm_ = shm;
+}
+
+connection *
+rpcc::connect_local()
+{
+	std::string path;
+	bool shm;
+	{
+		ScopedLock ml(&chan_m_);
+		path = local_;
+		shm = local_shm_;
+	}
+	return connect_to_local(path.c_str(), shm, this, lossytest_);
+}
+
+// streams connect in parallel; only the choice of transport is locked
+connection *
+rpcc::connect()
+{
+	bool local;
+	{
+		ScopedLock ml(&chan_m_);
+		local = !local_.empty();
+	}
+	if (local)
+		return connect_local();
+	return connect_to_dst(dst_, this, lossytest_);
+}
+
+void
+rpcs::listen_local(const std::string &path)
+{
+	ScopedLock ml(&conss_m_);
+	local_listeners_.push_back(new unixsconn(this, path.c_str(), lossytest_));
+}
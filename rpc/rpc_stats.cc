@@ -0,0 +1,54 @@
+// rpcs per-procedure statistics, reported through rpc_const::stats.
+
+#include <stdio.h>
+#include "rpc.h"
+
+static std::string
+proc_stat_name(unsigned int proc, const char *what)
+{
+	char b[64];
+	snprintf(b, sizeof(b), "rpc.0x%x.%s", proc, what);
+	return b;
+}
+
+static uint64_t
+elapsed_ns(const struct timespec &a, const struct timespec &b)
+{
+	if (b.tv_sec < a.tv_sec || (b.tv_sec == a.tv_sec && b.tv_nsec < a.tv_nsec))
+		return 0;
+	return (uint64_t) (b.tv_sec - a.tv_sec) * 1000000000 + b.tv_nsec - a.tv_nsec;
+}
+
+rpcs::proc_stats::proc_stats(unsigned int proc)
+	: queue_ns(proc_stat_name(proc, "queue_ns")),
+	handler_ns(proc_stat_name(proc, "handler_ns")),
+	reply_sz(proc_stat_name(proc, "reply_sz"))
+{
+}
+
+// called by add_proc() with procs_m_ held
+rpcs::proc_stats *
+rpcs::add_proc_stats(unsigned int proc)
+{
+	if (pstats_.find(proc) == pstats_.end())
+		pstats_[proc] = new proc_stats(proc);
+	return pstats_[proc];
+}
+
+// called by dispatch() once the reply for j has been built
+void
+rpcs::record_proc_stats(proc_stats *ps, const djob_t *j,
+		const struct timespec &start, const struct timespec &end, int rep_sz)
+{
+	ps->queue_ns.record(elapsed_ns(j->arrive, start));
+	ps->handler_ns.record(elapsed_ns(start, end));
+	ps->reply_sz.record(rep_sz);
+}
+
+int
+rpcs::rpcstats(int a, std::string &r)
+{
+	r = stats_dump();
+	r += lanes_.report();
+	return 0;
+}
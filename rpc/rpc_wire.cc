@@ -0,0 +1,36 @@
+// optional wire features, agreed per rpcc at bind() time. a client that
+// wants none, or a server that speaks none, stays on the fixed encoding,
+// so old and new peers interoperate.
+
+#include "rpc.h"
+#include "jsl_log.h"
+
+// what this build of the library can speak
+static const unsigned int supported_features = rpc_const::feature_compact;
+
+// the negotiation call itself always travels in the fixed encoding,
+// since features_ is still 0 while it is in flight
+void
+rpcc::negotiate(TO to)
+{
+	features_ = 0;
+	if (!want_features_)
+		return;
+	unsigned int have = 0;
+	int ret = call(rpc_const::features, want_features_, have, to);
+	if (ret != 0) {
+		jsl_log(JSL_DBG_2, "rpcc::negotiate %d: failed %d, using fixed encoding\n",
+				clt_nonce_, ret);
+		return;
+	}
+	features_ = have & want_features_ & supported_features;
+	jsl_log(JSL_DBG_2, "rpcc::negotiate %d: features 0x%x\n", clt_nonce_,
+			features_);
+}
+
+int
+rpcs::rpcfeatures(unsigned int want, unsigned int &have)
+{
+	have = want & supported_features;
+	return 0;
+}
@@ -0,0 +1,301 @@
+// RPC benchmark: throughput and latency of rpcc calls to an rpcs,
+// swept over procedure, payload size, client threads and streams.
+//
+//   null   int -> int, no payload
+//   echo   string -> the same string
+//   bulk   string -> int, payload one way
+//
+// usage: rpcbench [-s secs] [-t threads,...] [-c streams,...]
+//                 [-b bytes,...] [-P null,echo,bulk] [mode]
+// mode is one of
+//   inproc           rpcs and rpcc in this process (the default)
+//   fork [port]      rpcs in a child process, over loopback
+//   server port      serve until killed
+//   client [host:]port   drive a "server" elsewhere
+//
+// prints one line per configuration, for regression tracking:
+//   proc bytes threads streams ops ops-per-s p50-us p99-us p999-us cpu-us-per-op
+// cpu is this process's user+system time, so it covers the server too
+// in inproc mode and only the client otherwise.
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "rpc.h"
+#include "method_thread.h"
+
+enum {
+	null_proc = 0x7100,
+	echo_proc,
+	bulk_proc,
+};
+
+class bench_srv {
+	public:
+		int null(int a, int &r) { r = a; return 0; }
+		int echo(std::string s, std::string &r) { r = s; return 0; }
+		int bulk(std::string s, int &r) { r = s.size(); return 0; }
+};
+
+static void
+serve(rpcs *s, bench_srv *b)
+{
+	s->reg(null_proc, b, &bench_srv::null);
+	s->reg(echo_proc, b, &bench_srv::echo);
+	s->reg(bulk_proc, b, &bench_srv::bulk);
+}
+
+static uint64_t
+now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static uint64_t
+cpu_us()
+{
+	struct rusage ru;
+	VERIFY(getrusage(RUSAGE_SELF, &ru) == 0);
+	return (uint64_t) (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+		ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+// one client thread: calls back to back until told to stop
+struct loadgen {
+	rpcc *cl;
+	int proc;
+	std::string payload;
+	bool stop;
+	histogram *h;
+	uint64_t ops;
+	int errors;
+
+	void run() {
+		std::string rs;
+		int r;
+		while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+			uint64_t start = now_ns();
+			int ret;
+			if (proc == null_proc)
+				ret = cl->call(null_proc, 1, r);
+			else if (proc == echo_proc)
+				ret = cl->call(echo_proc, payload, rs);
+			else
+				ret = cl->call(bulk_proc, payload, r);
+			if (ret != 0) {
+				errors++;
+				continue;
+			}
+			h->record(now_ns() - start);
+			ops++;
+		}
+	}
+};
+
+static const char *
+proc_name(int proc)
+{
+	return proc == null_proc ? "null" : proc == echo_proc ? "echo" : "bulk";
+}
+
+static void
+run(rpcc *cl, int proc, int bytes, int nthreads, int streams, double secs)
+{
+	char hname[64];
+	snprintf(hname, sizeof(hname), "rpcbench.%s.%d.%d.%d", proc_name(proc),
+			bytes, nthreads, streams);
+	histogram h(hname);
+
+	std::vector<loadgen> g(nthreads);
+	for (int i = 0; i < nthreads; i++) {
+		g[i].cl = cl;
+		g[i].proc = proc;
+		g[i].payload.assign(bytes, 'x');
+		g[i].stop = false;
+		g[i].h = &h;
+		g[i].ops = 0;
+		g[i].errors = 0;
+	}
+
+	uint64_t cpu0 = cpu_us(), t0 = now_ns();
+	std::vector<pthread_t> th;
+	for (int i = 0; i < nthreads; i++)
+		th.push_back(method_thread(&g[i], false, &loadgen::run));
+	usleep((useconds_t) (secs * 1000000));
+	for (int i = 0; i < nthreads; i++)
+		__atomic_store_n(&g[i].stop, true, __ATOMIC_RELAXED);
+	uint64_t ops = 0;
+	int errors = 0;
+	for (int i = 0; i < nthreads; i++) {
+		VERIFY(pthread_join(th[i], NULL) == 0);
+		ops += g[i].ops;
+		errors += g[i].errors;
+	}
+	double elapsed = (now_ns() - t0) / 1e9;
+	uint64_t cpu = cpu_us() - cpu0;
+
+	if (errors)
+		fprintf(stderr, "rpcbench: %s %d bytes: %d failed calls\n",
+				proc_name(proc), bytes, errors);
+	printf("%s %d %d %d %llu %.0f %.1f %.1f %.1f %.2f\n", proc_name(proc),
+			bytes, nthreads, streams, (unsigned long long) ops, ops / elapsed,
+			h.percentile(0.50) / 1000.0, h.percentile(0.99) / 1000.0,
+			h.percentile(0.999) / 1000.0, ops ? (double) cpu / ops : 0.0);
+	fflush(stdout);
+}
+
+static std::vector<int>
+int_list(const char *s)
+{
+	std::vector<int> v;
+	while (*s) {
+		char *end;
+		long n = strtol(s, &end, 10);
+		if (end == s)
+			break;
+		v.push_back(n);
+		s = *end == ',' ? end + 1 : end;
+	}
+	return v;
+}
+
+static std::vector<int>
+proc_list(const char *s)
+{
+	std::vector<int> v;
+	if (strstr(s, "null"))
+		v.push_back(null_proc);
+	if (strstr(s, "echo"))
+		v.push_back(echo_proc);
+	if (strstr(s, "bulk"))
+		v.push_back(bulk_proc);
+	return v;
+}
+
+static void
+sweep(const char *dst, const std::vector<int> &procs,
+		const std::vector<int> &sizes, const std::vector<int> &threads,
+		const std::vector<int> &streams, double secs)
+{
+	sockaddr_in addr;
+	make_sockaddr(dst, &addr);
+
+	printf("# proc bytes threads streams ops ops-per-s p50-us p99-us p999-us cpu-us-per-op\n");
+	for (unsigned c = 0; c < streams.size(); c++) {
+		rpcc cl(addr);
+		cl.set_streams(streams[c]);
+		if (cl.bind() < 0) {
+			fprintf(stderr, "rpcbench: cannot bind to %s\n", dst);
+			exit(1);
+		}
+		for (unsigned p = 0; p < procs.size(); p++) {
+			for (unsigned b = 0; b < sizes.size(); b++) {
+				// null has no payload to vary
+				if (procs[p] == null_proc && b > 0)
+					break;
+				int bytes = procs[p] == null_proc ? 0 : sizes[b];
+				for (unsigned t = 0; t < threads.size(); t++)
+					run(&cl, procs[p], bytes, threads[t], streams[c], secs);
+			}
+		}
+	}
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s secs] [-t threads,...] [-c streams,...] "
+			"[-b bytes,...] [-P null,echo,bulk] "
+			"[inproc | fork [port] | server port | client [host:]port]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+	double secs = 1;
+	std::vector<int> threads = int_list("1,4,16");
+	std::vector<int> streams = int_list("1,4");
+	std::vector<int> sizes = int_list("0,64,1024,16384,262144,1048576");
+	std::vector<int> procs = proc_list("null,echo,bulk");
+
+	int ch;
+	while ((ch = getopt(argc, argv, "s:t:c:b:P:")) != -1) {
+		switch (ch) {
+		case 's': secs = atof(optarg); break;
+		case 't': threads = int_list(optarg); break;
+		case 'c': streams = int_list(optarg); break;
+		case 'b': sizes = int_list(optarg); break;
+		case 'P': procs = proc_list(optarg); break;
+		default: usage(argv[0]);
+		}
+	}
+	if (threads.empty() || streams.empty() || sizes.empty() || procs.empty())
+		usage(argv[0]);
+
+	std::string mode = optind < argc ? argv[optind] : "inproc";
+	const char *arg = optind + 1 < argc ? argv[optind + 1] : NULL;
+
+	// keep a write to a server that went away from killing us
+	signal(SIGPIPE, SIG_IGN);
+
+	bench_srv b;
+	if (mode == "server") {
+		if (!arg)
+			usage(argv[0]);
+		rpcs s(atoi(arg));
+		serve(&s, &b);
+		for (;;)
+			pause();
+	}
+	if (mode == "client") {
+		if (!arg)
+			usage(argv[0]);
+		sweep(arg, procs, sizes, threads, streams, secs);
+		return 0;
+	}
+
+	int port = arg ? atoi(arg) : 20000 + getpid() % 10000;
+	char dst[32];
+	snprintf(dst, sizeof(dst), "127.0.0.1:%d", port);
+
+	if (mode == "inproc") {
+		rpcs s(port);
+		serve(&s, &b);
+		sweep(dst, procs, sizes, threads, streams, secs);
+		return 0;
+	}
+	if (mode != "fork")
+		usage(argv[0]);
+
+	int rfd[2];
+	VERIFY(pipe(rfd) == 0);
+	pid_t pid = fork();
+	VERIFY(pid >= 0);
+	if (pid == 0) {
+		close(rfd[0]);
+		rpcs s(port);
+		serve(&s, &b);
+		// listening: let the parent connect
+		VERIFY(write(rfd[1], "", 1) == 1);
+		for (;;)
+			pause();
+	}
+	close(rfd[1]);
+	char c;
+	VERIFY(read(rfd[0], &c, 1) == 1);
+	sweep(dst, procs, sizes, threads, streams, secs);
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+	return 0;
+}
@@ -0,0 +1,33 @@
+// print the counters and histograms of a running rpcs.
+// usage: rpcstat [host:]port
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "rpc.h"
+
+int
+main(int argc, char *argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s [host:]port\n", argv[0]);
+		exit(1);
+	}
+
+	sockaddr_in dst;
+	make_sockaddr(argv[1], &dst);
+
+	rpcc cl(dst);
+	if (cl.bind() < 0) {
+		fprintf(stderr, "rpcstat: cannot bind to %s\n", argv[1]);
+		exit(1);
+	}
+
+	std::string s;
+	int ret = cl.call(rpc_const::stats, 0, s);
+	if (ret != 0) {
+		fprintf(stderr, "rpcstat: stats call failed %d\n", ret);
+		exit(1);
+	}
+	printf("%s", s.c_str());
+	return 0;
+}
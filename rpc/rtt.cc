@@ -0,0 +1,142 @@
+#include "rtt.h"
+#include "slock.h"
+#include "stats.h"
+
+static stat_counter retransmits("rpcc.retransmits");
+static histogram rtt_hist("rpcc.rtt_us");
+
+rtt_estimator::rtt_estimator() : srtt_(0), rttvar_(0), shift_(0)
+{
+	VERIFY(pthread_mutex_init(&m_, 0) == 0);
+}
+
+rtt_estimator::~rtt_estimator()
+{
+	VERIFY(pthread_mutex_destroy(&m_) == 0);
+}
+
+uint64_t
+rtt_estimator::rto_locked()
+{
+	uint64_t rto = srtt_ ? (srtt_ >> 3) + rttvar_ : RTT_INIT_US;
+	if (rto < RTT_MIN_US)
+		rto = RTT_MIN_US;
+	rto <<= shift_;
+	return rto > RTT_MAX_US ? RTT_MAX_US : rto;
+}
+
+uint64_t
+rtt_estimator::rto_us()
+{
+	ScopedLock ml(&m_);
+	return rto_locked();
+}
+
+void
+rtt_estimator::sample(uint64_t us)
+{
+	rtt_hist.record(us);
+	ScopedLock ml(&m_);
+	shift_ = 0;
+	if (!srtt_) {
+		// first sample: srtt = rtt, rttvar = rtt / 2
+		srtt_ = us << 3;
+		rttvar_ = us << 1;
+		return;
+	}
+	// err = rtt - srtt; srtt += err / 8; rttvar += (|err| - rttvar) / 4
+	int64_t err = (int64_t) us - (int64_t) (srtt_ >> 3);
+	srtt_ += err;
+	if (err < 0)
+		err = -err;
+	rttvar_ += err - (int64_t) (rttvar_ >> 2);
+}
+
+void
+rtt_estimator::timeout()
+{
+	retransmits.add();
+	ScopedLock ml(&m_);
+	if (shift_ < RTT_MAX_SHIFT)
+		shift_++;
+}
+
+uint64_t
+rtt_estimator::srtt_us()
+{
+	ScopedLock ml(&m_);
+	return srtt_ >> 3;
+}
+
+uint64_t
+rtt_estimator::rttvar_us()
+{
+	ScopedLock ml(&m_);
+	return rttvar_ >> 2;
+}
+
+static void
+add_us(const struct timespec &a, uint64_t us, struct timespec *r)
+{
+	uint64_t ns = a.tv_nsec + (us % 1000000) * 1000;
+	r->tv_sec = a.tv_sec + us / 1000000 + ns / 1000000000;
+	r->tv_nsec = ns % 1000000000;
+}
+
+static bool
+before(const struct timespec &a, const struct timespec &b)
+{
+	return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+rtt_call::rtt_call(rtt_estimator *e, int to_ms) : e_(e), retrans_(0)
+{
+	clock_gettime(CLOCK_REALTIME, &start_);
+	sent_ = start_;
+	add_us(start_, (uint64_t) to_ms * 1000, &deadline_);
+	rto_us_ = e_->rto_us();
+}
+
+void
+rtt_call::next_deadline(struct timespec *ts)
+{
+	add_us(sent_, rto_us_, ts);
+	if (before(deadline_, *ts))
+		*ts = deadline_;
+}
+
+void
+rtt_call::retransmit()
+{
+	e_->timeout();
+	retrans_++;
+	rto_us_ <<= 1;
+	if (rto_us_ > RTT_MAX_US)
+		rto_us_ = RTT_MAX_US;
+	clock_gettime(CLOCK_REALTIME, &sent_);
+}
+
+void
+rtt_call::done()
+{
+	if (retrans_)
+		return;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (before(now, start_))
+		return;  // the clock stepped back
+	e_->sample((now.tv_sec - start_.tv_sec) * 1000000 +
+			(now.tv_nsec - start_.tv_nsec) / 1000);
+}
+
+int
+rtt_call::remaining_ms()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	if (!before(now, deadline_))
+		return 1;
+	int ms = (deadline_.tv_sec - now.tv_sec) * 1000 +
+		(deadline_.tv_nsec - now.tv_nsec) / 1000000;
+	return ms > 0 ? ms : 1;
+}
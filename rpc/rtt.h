@@ -0,0 +1,75 @@
+#ifndef rtt_h
+#define rtt_h
+
+// retransmission timeouts for rpcc, after Jacobson and Karels: a
+// smoothed round-trip time and mean deviation per destination, and
+// RTO = srtt + 4 * rttvar, clamped to [RTT_MIN_US, RTT_MAX_US].
+//
+// a call that times out is retransmitted after RTO, then twice that,
+// and so on. following Karn, a reply to a retransmitted call is not a
+// sample (it could answer either copy), and the doubled RTO sticks for
+// later calls until a call gets through without retransmission.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+enum {
+	RTT_MIN_US = 1000,
+	RTT_MAX_US = 60 * 1000 * 1000,
+	RTT_INIT_US = 100 * 1000,  // before the first sample, rpcc::to_min
+	RTT_MAX_SHIFT = 6,         // backoff stops doubling after 64x
+};
+
+class rtt_estimator {
+	public:
+		rtt_estimator();
+		~rtt_estimator();
+
+		// timeout for a call's first transmission, backoff included
+		uint64_t rto_us();
+		// a reply came back us after the only transmission
+		void sample(uint64_t us);
+		// a call timed out and went out again
+		void timeout();
+
+		// for diagnostics; 0 before the first sample
+		uint64_t srtt_us();
+		uint64_t rttvar_us();
+
+	private:
+		pthread_mutex_t m_;
+		// fixed point, as in BSD: srtt_ is 8x and rttvar_ 4x the value
+		uint64_t srtt_;
+		uint64_t rttvar_;
+		int shift_;  // consecutive timeouts since the last sample
+
+		uint64_t rto_locked();
+};
+
+// one rpcc::call1's retransmission schedule
+class rtt_call {
+	public:
+		rtt_call(rtt_estimator *e, int to_ms);
+
+		// when to give up waiting for the current transmission: RTO after
+		// it was sent, but never past the call's own timeout
+		void next_deadline(struct timespec *ts);
+		// the transmission timed out and is being resent
+		void retransmit();
+		// the reply arrived; feeds the estimator if it can
+		void done();
+		// what is left of the call's timeout, at least 1, for each
+		// transmission's req_header::deadline_ms
+		int remaining_ms();
+
+	private:
+		rtt_estimator *e_;
+		struct timespec start_;     // CLOCK_REALTIME, like call1's waits
+		struct timespec sent_;
+		struct timespec deadline_;  // start_ + to_ms
+		uint64_t rto_us_;
+		int retrans_;
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "sendq.h"
+#include "slock.h"
+#include "stats.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+// PDUs gathered into one writev()
+enum { SENDQ_MAX_IOV = IOV_MAX < 64 ? IOV_MAX : 64 };
+
+static stat_counter sendq_writevs("sendq.writevs");
+static stat_counter sendq_pdus("sendq.pdus");
+
+sendq::sendq()
+	: off_(0), spare_(NULL), pushed_(0), written_(0), flushing_(false), failed_(false),
+	syscalls_(0)
+{
+	VERIFY(pthread_mutex_init(&m_, 0) == 0);
+	VERIFY(pthread_cond_init(&written_c_, 0) == 0);
+}
+
+sendq::~sendq()
+{
+	for (unsigned i = 0; i < q_.size(); i++)
+		free(q_[i].own);
+	free(spare_);
+	VERIFY(pthread_mutex_destroy(&m_) == 0);
+	VERIFY(pthread_cond_destroy(&written_c_) == 0);
+}
+
+sendq::ticket_t
+sendq::push(const char *b, int sz)
+{
+	ScopedLock ml(&m_);
+	return push_locked(b, sz);
+}
+
+sendq::ticket_t
+sendq::push_iov(const struct iovec *iov, int n)
+{
+	ticket_t t = 0;
+
+	ScopedLock ml(&m_);
+	for (int i = 0; i < n; i++) {
+		ticket_t ti = push_locked((const char *) iov[i].iov_base, iov[i].iov_len);
+		if (ti)
+			t = ti;
+	}
+	return t;
+}
+
+// caller holds m_
+sendq::ticket_t
+sendq::push_locked(const char *b, int sz)
+{
+	if (sz <= SENDQ_COPY_MAX) {
+		// bytes past a chunk's current sz are never being written, so
+		// appending is safe even while a flush is in progress.
+		if (q_.empty() || !q_.back().own || q_.back().cap - q_.back().sz < sz) {
+			item it;
+			it.own = spare_ ? spare_ : (char *) malloc(SENDQ_CHUNK);
+			VERIFY(it.own);
+			spare_ = NULL;
+			it.b = it.own;
+			it.sz = 0;
+			it.cap = SENDQ_CHUNK;
+			q_.push_back(it);
+			++pushed_;
+		}
+		memcpy(q_.back().own + q_.back().sz, b, sz);
+		q_.back().sz += sz;
+		return 0;
+	}
+
+	item it;
+	it.b = b;
+	it.sz = sz;
+	it.own = NULL;
+	it.cap = 0;
+	q_.push_back(it);
+	return ++pushed_;
+}
+
+int
+sendq::flush(int fd)
+{
+	struct iovec iov[SENDQ_MAX_IOV];
+
+	ScopedLock ml(&m_);
+	if (flushing_)
+		return BUSY;
+	if (failed_)
+		return FAILED;
+	flushing_ = true;
+
+	int ret = DRAINED;
+	while (!q_.empty()) {
+		// only the flusher pops, so the items stay put while unlocked
+		int n = 0;
+		for (std::deque<item>::iterator i = q_.begin();
+				i != q_.end() && n < SENDQ_MAX_IOV; ++i, ++n) {
+			iov[n].iov_base = (void *) i->b;
+			iov[n].iov_len = i->sz;
+		}
+		iov[0].iov_base = (char *) iov[0].iov_base + off_;
+		iov[0].iov_len -= off_;
+
+		VERIFY(pthread_mutex_unlock(&m_) == 0);
+		ssize_t w = writev(fd, iov, n);
+		VERIFY(pthread_mutex_lock(&m_) == 0);
+		syscalls_++;
+		sendq_writevs.add();
+
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			ret = (errno == EAGAIN || errno == EWOULDBLOCK) ? BLOCKED : FAILED;
+			break;
+		}
+
+		// retire the PDUs this writev completed
+		size_t left = w;
+		int done = 0;
+		while (!q_.empty() && left >= (size_t) (q_.front().sz - off_)) {
+			left -= q_.front().sz - off_;
+			off_ = 0;
+			if (!spare_)
+				spare_ = q_.front().own;
+			else
+				free(q_.front().own);
+			q_.pop_front();
+			done++;
+		}
+		off_ += left;
+		if (done) {
+			written_ += done;
+			sendq_pdus.add(done);
+			VERIFY(pthread_cond_broadcast(&written_c_) == 0);
+		}
+	}
+
+	if (ret == FAILED)
+		failed_ = true;
+	flushing_ = false;
+	VERIFY(pthread_cond_broadcast(&written_c_) == 0);
+	return ret;
+}
+
+bool
+sendq::wait(ticket_t t)
+{
+	ScopedLock ml(&m_);
+	while (written_ < t && !failed_)
+		VERIFY(pthread_cond_wait(&written_c_, &m_) == 0);
+	return written_ >= t;
+}
+
+bool
+sendq::written(ticket_t t)
+{
+	ScopedLock ml(&m_);
+	return written_ >= t;
+}
+
+void
+sendq::fail()
+{
+	ScopedLock ml(&m_);
+	failed_ = true;
+	VERIFY(pthread_cond_broadcast(&written_c_) == 0);
+}
+
+bool
+sendq::empty()
+{
+	ScopedLock ml(&m_);
+	return q_.empty();
+}
@@ -0,0 +1,75 @@
+#ifndef sendq_h
+#define sendq_h
+
+// multi-producer send queue for one connection.
+//
+// any number of threads push() PDUs; whichever thread calls flush()
+// (a sender that found no flush in progress, or the write callback)
+// writes out everything queued so far with writev(), so concurrent small
+// PDUs share a syscall instead of waiting for each other's slot.
+//
+// PDUs up to SENDQ_COPY_MAX bytes are copied into a queue-owned chunk,
+// packed back to back, and push() returns ticket 0: the sender may reuse
+// its buffer at once. larger PDUs are queued by reference and the sender
+// wait()s until its ticket has been written, the same contract as
+// connection::send().
+
+#include <pthread.h>
+#include <sys/uio.h>
+#include <deque>
+
+enum {
+	SENDQ_COPY_MAX = 2048,
+	SENDQ_CHUNK = 16384,
+};
+
+class sendq {
+	public:
+		typedef unsigned long long ticket_t;
+
+		// return values of flush()
+		enum { DRAINED = 0, BLOCKED = 1, BUSY = 2, FAILED = -1 };
+
+		sendq();
+		~sendq();
+
+		ticket_t push(const char *b, int sz);
+		// queue one PDU given as a gather list (see marshall::iov());
+		// the ticket covers every segment.
+		ticket_t push_iov(const struct iovec *iov, int n);
+		// write until the queue is empty (DRAINED) or the socket is full
+		// (BLOCKED); BUSY if another thread is already flushing.
+		int flush(int fd);
+		// block until t has been written; false if the queue failed
+		bool wait(ticket_t t);
+		bool written(ticket_t t);
+		// give up on everything queued, e.g. the connection died
+		void fail();
+		bool empty();
+
+		unsigned long long syscalls() { return syscalls_; }
+
+	private:
+		ticket_t push_locked(const char *b, int sz);
+
+		struct item {
+			const char *b;
+			int sz;
+			char *own;  // queue-owned chunk (b == own), or NULL
+			int cap;
+		};
+
+		std::deque<item> q_;  // not yet completely written
+		int off_;             // bytes of q_.front() already written
+		char *spare_;         // a drained chunk kept for reuse
+		ticket_t pushed_;
+		ticket_t written_;
+		bool flushing_;
+		bool failed_;
+		unsigned long long syscalls_;
+
+		pthread_mutex_t m_;
+		pthread_cond_t written_c_;
+};
+
+#endif
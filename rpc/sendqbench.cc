@@ -0,0 +1,152 @@
+// sendq benchmark: concurrent senders on one TCP loopback connection.
+//
+// "slot" reproduces connection::send()'s single wpdu_ slot: each sender
+// waits for the previous PDU to drain, then write()s its own. "sendq"
+// pushes into a sendq and lets one sender writev() the whole backlog.
+//
+// usage: sendqbench [pdu-size] [pdus-per-thread]
+// prints one line per mode and thread count:
+//   mode threads pdus syscalls pdus/syscall kpdus/s
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
+
+#include "sendq.h"
+#include "slock.h"
+#include "method_thread.h"
+
+class bench {
+	public:
+		bench(int fd, int sz, int n) : fd_(fd), sz_(sz), n_(n), syscalls_(0) {
+			VERIFY(pthread_mutex_init(&slot_m_, 0) == 0);
+		}
+
+		void slot_sender() {
+			std::vector<char> pdu(sz_, 'x');
+			for (int i = 0; i < n_; i++) {
+				ScopedLock ml(&slot_m_);
+				int off = 0;
+				while (off < sz_) {
+					ssize_t w = write(fd_, &pdu[off], sz_ - off);
+					syscalls_++;
+					VERIFY(w > 0 || errno == EINTR);
+					if (w > 0)
+						off += w;
+				}
+			}
+		}
+
+		void sendq_sender() {
+			std::vector<char> pdu(sz_, 'x');
+			for (int i = 0; i < n_; i++) {
+				sendq::ticket_t t = q_.push(&pdu[0], sz_);
+				int r = q_.flush(fd_);
+				VERIFY(r == sendq::DRAINED || r == sendq::BUSY);
+				VERIFY(q_.wait(t));
+			}
+		}
+
+		int fd_;
+		int sz_;
+		int n_;
+		unsigned long long syscalls_;
+		pthread_mutex_t slot_m_;
+		sendq q_;
+};
+
+struct drain {
+	int fd;
+	unsigned long long want;
+	void run() {
+		char buf[65536];
+		unsigned long long got = 0;
+		while (got < want) {
+			ssize_t r = read(fd, buf, sizeof(buf));
+			VERIFY(r > 0 || errno == EINTR);
+			if (r > 0)
+				got += r;
+		}
+	}
+};
+
+static void
+tcp_pair(int *a, int *b)
+{
+	int l = socket(AF_INET, SOCK_STREAM, 0);
+	VERIFY(l >= 0);
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = 0;
+	VERIFY(bind(l, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+	VERIFY(listen(l, 1) == 0);
+	socklen_t len = sizeof(sin);
+	VERIFY(getsockname(l, (struct sockaddr *) &sin, &len) == 0);
+
+	*a = socket(AF_INET, SOCK_STREAM, 0);
+	VERIFY(connect(*a, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+	*b = accept(l, NULL, NULL);
+	VERIFY(*b >= 0);
+	close(l);
+
+	int yes = 1;
+	setsockopt(*a, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+}
+
+static void
+run(const char *mode, int nthreads, int sz, int n)
+{
+	int a, b;
+	tcp_pair(&a, &b);
+
+	bench bn(a, sz, n);
+	drain d;
+	d.fd = b;
+	d.want = (unsigned long long) nthreads * n * sz;
+	pthread_t dt = method_thread(&d, false, &drain::run);
+
+	struct timeval start, end;
+	gettimeofday(&start, NULL);
+	std::vector<pthread_t> th;
+	bool slot = strcmp(mode, "slot") == 0;
+	for (int i = 0; i < nthreads; i++)
+		th.push_back(method_thread(&bn, false,
+					slot ? &bench::slot_sender : &bench::sendq_sender));
+	for (int i = 0; i < nthreads; i++)
+		VERIFY(pthread_join(th[i], NULL) == 0);
+	VERIFY(pthread_join(dt, NULL) == 0);
+	gettimeofday(&end, NULL);
+
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+	unsigned long long pdus = (unsigned long long) nthreads * n;
+	unsigned long long calls = slot ? bn.syscalls_ : bn.q_.syscalls();
+	printf("%s %d %llu %llu %.2f %.1f\n", mode, nthreads, pdus, calls,
+			(double) pdus / calls, pdus / secs / 1000);
+	close(a);
+	close(b);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int sz = argc > 1 ? atoi(argv[1]) : 64;
+	int n = argc > 2 ? atoi(argv[2]) : 20000;
+	int threads[] = { 1, 4, 16, 64 };
+
+	printf("# mode threads pdus syscalls pdus/syscall kpdus/s (pdu %d bytes)\n", sz);
+	for (unsigned i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+		run("slot", threads[i], sz, n);
+		run("sendq", threads[i], sz, n);
+	}
+	return 0;
+}
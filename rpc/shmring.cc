@@ -0,0 +1,156 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "shmring.h"
+#include "lang/verify.h"
+
+void
+shmring::attach(void *base)
+{
+	h_ = (hdr *) base;
+	data_ = (char *) base + sizeof(hdr);
+}
+
+// bytes between tail and head, or 0 once they are inconsistent
+size_t
+shmring::used(unsigned long long head, unsigned long long tail)
+{
+	if (head - tail > SHM_RING_SIZE)
+		broken_ = true;
+	return broken_ ? 0 : head - tail;
+}
+
+int
+shmring::write(const char *b, int sz)
+{
+	unsigned long long head = h_->head;
+	unsigned long long tail = __atomic_load_n(&h_->tail, __ATOMIC_ACQUIRE);
+	size_t u = used(head, tail);
+	if (broken_)
+		return 0;
+	size_t space = SHM_RING_SIZE - u;
+	size_t n = (size_t) sz < space ? sz : space;
+	size_t off = head & (SHM_RING_SIZE - 1);
+	size_t first = n < SHM_RING_SIZE - off ? n : SHM_RING_SIZE - off;
+	memcpy(data_ + off, b, first);
+	memcpy(data_, b + first, n - first);
+	__atomic_store_n(&h_->head, head + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+int
+shmring::read(char *b, int sz)
+{
+	unsigned long long tail = h_->tail;
+	unsigned long long head = __atomic_load_n(&h_->head, __ATOMIC_ACQUIRE);
+	size_t avail = used(head, tail);
+	size_t n = (size_t) sz < avail ? sz : avail;
+	size_t off = tail & (SHM_RING_SIZE - 1);
+	size_t first = n < SHM_RING_SIZE - off ? n : SHM_RING_SIZE - off;
+	memcpy(b, data_ + off, first);
+	memcpy(b + first, data_, n - first);
+	__atomic_store_n(&h_->tail, tail + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+size_t
+shmring::readable()
+{
+	return used(__atomic_load_n(&h_->head, __ATOMIC_ACQUIRE), h_->tail);
+}
+
+bool
+shmring::arm()
+{
+	__atomic_store_n(&h_->armed, 1, __ATOMIC_SEQ_CST);
+	if (readable() == 0)
+		return true;
+	__atomic_store_n(&h_->armed, 0, __ATOMIC_SEQ_CST);
+	return false;
+}
+
+void
+shmring::kick(int efd)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&h_->armed, __ATOMIC_SEQ_CST) &&
+			__atomic_exchange_n(&h_->armed, 0, __ATOMIC_SEQ_CST)) {
+		uint64_t one = 1;
+		if (::write(efd, &one, sizeof(one)) != sizeof(one))
+			VERIFY(errno == EAGAIN);  // counter saturated: already signalled
+	}
+}
+
+void
+shmring::close()
+{
+	__atomic_store_n(&h_->closed, 1, __ATOMIC_SEQ_CST);
+}
+
+bool
+shmring::closed()
+{
+	return broken_ || __atomic_load_n(&h_->closed, __ATOMIC_SEQ_CST);
+}
+
+shm_pair::~shm_pair()
+{
+	if (base_)
+		munmap(base_, 2 * shmring::region_size());
+	if (fd_ >= 0)
+		::close(fd_);
+}
+
+bool
+shm_pair::map(bool creator)
+{
+	// a short memfd from the peer would fault on first touch
+	struct stat st;
+	if (fstat(fd_, &st) != 0 || st.st_size < (off_t) (2 * shmring::region_size()))
+		return false;
+	base_ = mmap(NULL, 2 * shmring::region_size(), PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd_, 0);
+	if (base_ == MAP_FAILED) {
+		base_ = NULL;
+		return false;
+	}
+	char *r0 = (char *) base_;
+	char *r1 = r0 + shmring::region_size();
+	tx.attach(creator ? r0 : r1);
+	rx.attach(creator ? r1 : r0);
+	return true;
+}
+
+bool
+shm_pair::create()
+{
+#if defined(__linux__) && defined(SYS_memfd_create)
+	fd_ = syscall(SYS_memfd_create, "rpc-shm", 0);
+#else
+	char name[64];
+	snprintf(name, sizeof(name), "/rpc-shm-%d-%p", getpid(), (void *) this);
+	fd_ = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd_ >= 0)
+		shm_unlink(name);
+#endif
+	if (fd_ < 0)
+		return false;
+	// the mapping starts zero-filled: empty rings, nobody armed
+	if (ftruncate(fd_, 2 * shmring::region_size()) != 0)
+		return false;
+	return map(true);
+}
+
+bool
+shm_pair::attach(int fd)
+{
+	fd_ = fd;
+	return map(false);
+}
@@ -0,0 +1,82 @@
+#ifndef shmring_h
+#define shmring_h
+
+// single-producer single-consumer byte stream in shared memory.
+//
+// a shmring is a header plus SHM_RING_SIZE data bytes inside a mapping
+// both processes share; a shm_pair maps one memfd holding two rings, one
+// per direction. the stream carries the same bytes a TCP connection
+// would (each PDU starts with its own length), so readers frame PDUs the
+// same way connection::readpdu() does.
+//
+// head and tail only ever grow and live on separate cache lines. the
+// peer can write anything into the mapping, so a ring whose head and
+// tail are more than SHM_RING_SIZE apart is treated as closed. the
+// consumer arm()s before sleeping on its eventfd; the producer rings that
+// eventfd only if the consumer is armed, so a busy consumer costs the
+// producer no syscalls.
+
+#include <stddef.h>
+
+enum {
+	SHM_RING_SIZE = 256 * 1024,  // power of two
+};
+
+class shmring {
+	public:
+		struct hdr {
+			unsigned long long head __attribute__((aligned(64)));  // bytes produced
+			unsigned long long tail __attribute__((aligned(64)));  // bytes consumed
+			unsigned int armed __attribute__((aligned(64)));       // consumer may sleep
+			unsigned int closed;
+		};
+
+		shmring() : h_(NULL), data_(NULL), broken_(false) { }
+		void attach(void *base);
+
+		// copy up to sz bytes in (out); returns the count, 0 if full (empty)
+		int write(const char *b, int sz);
+		int read(char *b, int sz);
+		size_t readable();
+
+		// consumer: about to sleep. returns false if data is already
+		// there, in which case the caller should keep reading.
+		bool arm();
+		// producer: wake the consumer through efd if it is armed
+		void kick(int efd);
+
+		void close();
+		// the other side closed the ring, or left it inconsistent
+		bool closed();
+
+		static size_t region_size() { return sizeof(hdr) + SHM_RING_SIZE; }
+
+	private:
+		hdr *h_;
+		char *data_;
+		bool broken_;  // head and tail were seen too far apart
+
+		size_t used(unsigned long long head, unsigned long long tail);
+};
+
+// the two rings of a connection in one memfd. the side that connects
+// creates it and passes the fd to the other side, which attaches with
+// the rings swapped.
+class shm_pair {
+	public:
+		shm_pair() : base_(NULL), fd_(-1) { }
+		~shm_pair();
+		bool create();
+		bool attach(int fd);
+		int fd() { return fd_; }
+
+		shmring tx;
+		shmring rx;
+
+	private:
+		void *base_;
+		int fd_;
+		bool map(bool creator);
+};
+
+#endif
@@ -0,0 +1,211 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+#include "slock.h"
+#include "stats.h"
+
+static stat_counter slab_spans("slab.spans");
+static stat_counter slab_remote("slab.remote_frees");
+static stat_counter slab_large("slab.large");
+static stat_counter slab_exhausted("slab.exhausted");
+
+// one per thread that has allocated. never freed: when its thread exits
+// it waits on orphans for the next new thread, since other threads may
+// still be handing blocks back through remote.
+struct slab_cache {
+	void *free[SLAB_CLASSES];
+	slab_cache *next_orphan;
+	// blocks other threads freed, pushed without locks
+	void *remote[SLAB_CLASSES] __attribute__((aligned(64)));
+};
+
+static char *region;              // SLAB_REGION_SPANS spans, or NULL
+static unsigned next_span;        // spans handed out so far
+static slab_cache *span_owner[SLAB_REGION_SPANS];
+static unsigned char span_cls[SLAB_REGION_SPANS];
+static bool enabled;
+
+static pthread_once_t slab_once = PTHREAD_ONCE_INIT;
+static pthread_key_t cache_key;
+static pthread_mutex_t orphans_m = PTHREAD_MUTEX_INITIALIZER;
+static slab_cache *orphans;
+
+static __thread slab_cache *my_cache;
+
+static void
+cache_exit(void *a)
+{
+	slab_cache *c = (slab_cache *) a;
+	// later frees on this thread go through remote
+	my_cache = NULL;
+	ScopedLock ml(&orphans_m);
+	c->next_orphan = orphans;
+	orphans = c;
+}
+
+static void
+slab_init()
+{
+	VERIFY(pthread_key_create(&cache_key, cache_exit) == 0);
+	const char *e = getenv("RPC_SLAB");
+	enabled = !e || atoi(e) != 0;
+
+	size_t len = (size_t) SLAB_REGION_SPANS * SLAB_SPAN;
+	void *p = mmap(NULL, len + SLAB_SPAN, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED) {
+		enabled = false;
+		return;
+	}
+	uintptr_t a = ((uintptr_t) p + SLAB_SPAN - 1) & ~(uintptr_t) (SLAB_SPAN - 1);
+	region = (char *) a;
+}
+
+static slab_cache *
+cache()
+{
+	if (my_cache)
+		return my_cache;
+	slab_cache *c;
+	{
+		ScopedLock ml(&orphans_m);
+		c = orphans;
+		if (c)
+			orphans = c->next_orphan;
+	}
+	if (!c) {
+		c = new slab_cache;
+		memset(c, 0, sizeof(*c));
+	}
+	VERIFY(pthread_setspecific(cache_key, c) == 0);
+	my_cache = c;
+	return c;
+}
+
+static int
+size_class(size_t n)
+{
+	if (n <= (1 << SLAB_MIN_BITS))
+		return 0;
+	return (64 - __builtin_clzll(n - 1)) - SLAB_MIN_BITS;
+}
+
+static bool
+owns(const void *p)
+{
+	return region && (const char *) p >= region &&
+		(const char *) p < region + (size_t) SLAB_REGION_SPANS * SLAB_SPAN;
+}
+
+static unsigned
+span_of(const void *p)
+{
+	return ((const char *) p - region) >> SLAB_SPAN_BITS;
+}
+
+// a fresh span of class k, threaded onto c's free list; false if the
+// region is used up
+static bool
+refill(slab_cache *c, int k)
+{
+	unsigned s = __atomic_fetch_add(&next_span, 1, __ATOMIC_RELAXED);
+	if (s >= SLAB_REGION_SPANS) {
+		slab_exhausted.add();
+		return false;
+	}
+	span_owner[s] = c;
+	span_cls[s] = k;
+	slab_spans.add();
+
+	size_t bsz = (size_t) 1 << (SLAB_MIN_BITS + k);
+	char *base = region + (size_t) s * SLAB_SPAN;
+	void *head = c->free[k];
+	for (size_t off = SLAB_SPAN; off >= bsz; off -= bsz) {
+		*(void **) (base + off - bsz) = head;
+		head = base + off - bsz;
+	}
+	c->free[k] = head;
+	return true;
+}
+
+void *
+slab_alloc(size_t n)
+{
+	pthread_once(&slab_once, slab_init);
+	if (n > SLAB_MAX || !__atomic_load_n(&enabled, __ATOMIC_RELAXED)) {
+		if (n > SLAB_MAX)
+			slab_large.add();
+		return malloc(n);
+	}
+	slab_cache *c = cache();
+	int k = size_class(n);
+	void *p = c->free[k];
+	if (!p) {
+		p = __atomic_exchange_n(&c->remote[k], NULL, __ATOMIC_ACQUIRE);
+		if (!p) {
+			if (!refill(c, k))
+				return malloc(n);
+			p = c->free[k];
+		}
+	}
+	c->free[k] = *(void **) p;
+	return p;
+}
+
+void
+slab_free(void *p)
+{
+	if (!owns(p)) {
+		free(p);
+		return;
+	}
+	unsigned s = span_of(p);
+	slab_cache *o = span_owner[s];
+	int k = span_cls[s];
+	if (o == my_cache) {
+		*(void **) p = o->free[k];
+		o->free[k] = p;
+		return;
+	}
+	slab_remote.add();
+	void *head = __atomic_load_n(&o->remote[k], __ATOMIC_RELAXED);
+	do {
+		*(void **) p = head;
+	} while (!__atomic_compare_exchange_n(&o->remote[k], &head, p, true,
+				__ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void *
+slab_realloc(void *p, size_t n)
+{
+	if (!p)
+		return slab_alloc(n);
+	if (!owns(p))
+		return realloc(p, n);
+	size_t have = (size_t) 1 << (SLAB_MIN_BITS + span_cls[span_of(p)]);
+	if (n <= have)
+		return p;
+	void *q = slab_alloc(n);
+	if (q) {
+		memcpy(q, p, have);
+		slab_free(p);
+	}
+	return q;
+}
+
+bool
+slab_owns(const void *p)
+{
+	return owns(p);
+}
+
+void
+slab_enable(bool on)
+{
+	pthread_once(&slab_once, slab_init);
+	__atomic_store_n(&enabled, on && region != NULL, __ATOMIC_RELAXED);
+}
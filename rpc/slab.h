@@ -0,0 +1,51 @@
+#ifndef slab_h
+#define slab_h
+
+// per-thread slab allocator for RPC buffers and short-lived objects.
+//
+// requests up to SLAB_MAX bytes are rounded up to a power of two and
+// served from the calling thread's free list for that size, without a
+// lock. each thread carves its blocks out of 64 KB spans of one size,
+// taken from a region reserved at start-up. a block freed by a thread
+// other than the one that allocated it, e.g. a PDU read on the poll
+// thread and freed by a worker, is pushed onto its owner's remote-free
+// list for that size; the owner takes the whole list back when its own
+// list runs dry.
+//
+// larger requests, and every request once the region is used up or
+// RPC_SLAB=0, go to malloc(). slab_free() and slab_realloc() take
+// pointers from either, so buffers that arrive from code using malloc
+// can be freed the same way; memory from slab_alloc() must not be
+// given to free(). buffers the library hands out, e.g. from
+// marshall::take_buf() and unmarshall::take_buf(), come from the
+// slabs and are released with slab_free().
+
+#include <stddef.h>
+
+enum {
+	SLAB_MIN_BITS = 6,       // 64-byte blocks and up
+	SLAB_CLASSES = 9,        // ... to 16 KB
+	SLAB_MAX = 1 << (SLAB_MIN_BITS + SLAB_CLASSES - 1),
+	SLAB_SPAN_BITS = 16,
+	SLAB_SPAN = 1 << SLAB_SPAN_BITS,
+	SLAB_REGION_SPANS = 16384, // 1 GB of address space, touched as used
+};
+
+void *slab_alloc(size_t n);
+void slab_free(void *p);
+void *slab_realloc(void *p, size_t n);
+// whether p came from the slabs rather than malloc()
+bool slab_owns(const void *p);
+
+// whether slab_alloc() uses slabs: RPC_SLAB, unless set here. blocks
+// already handed out stay valid either way.
+void slab_enable(bool on);
+
+// for classes whose instances come and go with each RPC
+class slab_object {
+	public:
+		static void *operator new(size_t n) { return slab_alloc(n); }
+		static void operator delete(void *p) { slab_free(p); }
+};
+
+#endif
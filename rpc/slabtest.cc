@@ -0,0 +1,177 @@
+// slab allocator (slab.h) tests: blocks freed by another thread, the
+// caches of exited threads, realloc between size classes and out to
+// malloc, and the malloc fallback.
+// usage: slabtest
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "slab.h"
+#include "stats.h"
+#include "method_thread.h"
+#include "lang/verify.h"
+
+static uint64_t
+spans()
+{
+	return stats_counter_value("slab.spans");
+}
+
+// all the blocks of one span of 1 KB blocks
+enum { NBLOCKS = SLAB_SPAN / 1024 };
+
+struct worker {
+	std::vector<void *> blocks;
+	void alloc() {
+		for (int i = 0; i < NBLOCKS; i++) {
+			void *p = slab_alloc(1000);
+			VERIFY(slab_owns(p));
+			memset(p, i, 1000);
+			blocks.push_back(p);
+		}
+	}
+	void free_all() {
+		for (unsigned i = 0; i < blocks.size(); i++)
+			slab_free(blocks[i]);
+		blocks.clear();
+	}
+	void alloc_free() {
+		alloc();
+		free_all();
+	}
+};
+
+static void
+run(worker *w, void (worker::*m)())
+{
+	pthread_t th = method_thread(w, false, m);
+	VERIFY(pthread_join(th, NULL) == 0);
+}
+
+// blocks a thread frees for another go back to their owner, which
+// reuses them before taking a new span
+void
+remote_tests()
+{
+	printf("remote_tests\n");
+	worker a;
+	a.alloc();
+	std::vector<void *> first = a.blocks;
+	uint64_t s0 = spans();
+	uint64_t r0 = stats_counter_value("slab.remote_frees");
+
+	worker b;
+	b.blocks = a.blocks;
+	a.blocks.clear();
+	run(&b, &worker::free_all);
+	VERIFY(stats_counter_value("slab.remote_frees") - r0 == NBLOCKS);
+
+	a.alloc();
+	VERIFY(spans() == s0);
+	std::vector<void *> second = a.blocks;
+	std::sort(first.begin(), first.end());
+	std::sort(second.begin(), second.end());
+	VERIFY(first == second);
+	a.free_all();
+	printf(" -- remote OK\n");
+}
+
+// a thread that exits leaves its cache, and the blocks freed into it
+// after it went, to the next new thread
+void
+exit_tests()
+{
+	printf("exit_tests\n");
+	worker a;
+	run(&a, &worker::alloc);
+	uint64_t s0 = spans();
+	// freed after a's thread has gone: onto its orphaned cache
+	a.free_all();
+
+	worker b;
+	run(&b, &worker::alloc);
+	VERIFY(spans() == s0);
+	b.free_all();
+	printf(" -- exit OK\n");
+}
+
+void
+realloc_tests()
+{
+	printf("realloc_tests\n");
+	char *p = (char *) slab_alloc(100);
+	VERIFY(slab_owns(p));
+	for (int i = 0; i < 100; i++)
+		p[i] = i;
+
+	// a size its block already has room for stays put
+	VERIFY(slab_realloc(p, 128) == p);
+	VERIFY(slab_realloc(p, 10) == p);
+
+	// up a few classes, keeping the contents
+	char *q = (char *) slab_realloc(p, 5000);
+	VERIFY(q != p && slab_owns(q));
+	for (int i = 0; i < 100; i++)
+		VERIFY(q[i] == i);
+	memset(q + 100, 7, 4900);
+
+	// past SLAB_MAX, to malloc
+	char *r = (char *) slab_realloc(q, SLAB_MAX + 1);
+	VERIFY(r && !slab_owns(r));
+	for (int i = 0; i < 100; i++)
+		VERIFY(r[i] == i);
+	VERIFY(r[4999] == 7);
+	// and on within malloc
+	r = (char *) slab_realloc(r, 4 * SLAB_MAX);
+	VERIFY(r && !slab_owns(r) && r[4999] == 7);
+	slab_free(r);
+
+	VERIFY(slab_owns(slab_realloc(NULL, 64)));
+	printf(" -- realloc OK\n");
+}
+
+void
+fallback_tests()
+{
+	printf("fallback_tests\n");
+	uint64_t l0 = stats_counter_value("slab.large");
+	void *big = slab_alloc(SLAB_MAX + 1);
+	VERIFY(big && !slab_owns(big));
+	VERIFY(stats_counter_value("slab.large") == l0 + 1);
+	slab_free(big);
+
+	// malloc'd buffers from elsewhere can be freed and grown alike
+	char *m = (char *) malloc(32);
+	strcpy(m, "from malloc");
+	m = (char *) slab_realloc(m, 64);
+	VERIFY(!slab_owns(m) && !strcmp(m, "from malloc"));
+	slab_free(m);
+	slab_free(NULL);
+
+	void *on = slab_alloc(64);
+	slab_enable(false);
+	void *off = slab_alloc(64);
+	VERIFY(slab_owns(on) && !slab_owns(off));
+	// blocks handed out before stay valid
+	slab_free(on);
+	slab_free(off);
+	slab_enable(true);
+	on = slab_alloc(64);
+	VERIFY(slab_owns(on));
+	slab_free(on);
+	printf(" -- fallback OK\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	slab_enable(true);
+	remote_tests();
+	exit_tests();
+	realloc_tests();
+	fallback_tests();
+	printf("slabtest OK\n");
+	return 0;
+}
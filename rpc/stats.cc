@@ -0,0 +1,208 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <set>
+
+#include "stats.h"
+#include "slock.h"
+
+namespace {
+
+struct stat_registry {
+	pthread_mutex_t m;
+	std::set<stat_counter *> counters;
+	std::set<histogram *> histograms;
+	stat_registry() { VERIFY(pthread_mutex_init(&m, 0) == 0); }
+};
+
+// function-local so static counters in other files can register
+// during their own initialization.
+stat_registry &
+registry()
+{
+	static stat_registry r;
+	return r;
+}
+
+int next_shard;
+__thread int my_shard = -1;
+
+}
+
+int
+stat_shard()
+{
+	if (my_shard < 0)
+		my_shard = __atomic_fetch_add(&next_shard, 1, __ATOMIC_RELAXED) % STAT_SHARDS;
+	return my_shard;
+}
+
+stat_counter::stat_counter(const std::string &name) : name_(name)
+{
+	memset(shards_, 0, sizeof(shards_));
+	ScopedLock ml(&registry().m);
+	registry().counters.insert(this);
+}
+
+stat_counter::~stat_counter()
+{
+	ScopedLock ml(&registry().m);
+	registry().counters.erase(this);
+}
+
+uint64_t
+stat_counter::value()
+{
+	uint64_t v = 0;
+	for (int i = 0; i < STAT_SHARDS; i++)
+		v += __atomic_load_n(&shards_[i].v, __ATOMIC_RELAXED);
+	return v;
+}
+
+histogram::histogram(const std::string &name) : name_(name)
+{
+	memset(shards_, 0, sizeof(shards_));
+	ScopedLock ml(&registry().m);
+	registry().histograms.insert(this);
+}
+
+histogram::~histogram()
+{
+	ScopedLock ml(&registry().m);
+	registry().histograms.erase(this);
+}
+
+int
+histogram::bucket(uint64_t v)
+{
+	if (v < HIST_LINEAR)
+		return v;
+	int msb = 63 - __builtin_clzll(v);
+	if (msb >= HIST_MAX_BITS)
+		return HIST_BUCKETS - 1;
+	int sub = (v >> (msb - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1);
+	return HIST_LINEAR + (msb - HIST_SUB_BITS - 1) * (1 << HIST_SUB_BITS) + sub;
+}
+
+uint64_t
+histogram::bucket_high(int b)
+{
+	if (b < HIST_LINEAR)
+		return b;
+	int msb = HIST_SUB_BITS + 1 + (b - HIST_LINEAR) / (1 << HIST_SUB_BITS);
+	int sub = (b - HIST_LINEAR) % (1 << HIST_SUB_BITS);
+	int shift = msb - HIST_SUB_BITS;
+	return ((uint64_t) ((1 << HIST_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+void
+histogram::record(uint64_t v)
+{
+	shard &s = shards_[stat_shard()];
+	__atomic_fetch_add(&s.buckets[bucket(v)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s.count, 1, __ATOMIC_RELAXED);
+	// only this shard's threads raise its max, races just lose a sample
+	if (v > __atomic_load_n(&s.max, __ATOMIC_RELAXED))
+		__atomic_store_n(&s.max, v, __ATOMIC_RELAXED);
+}
+
+uint64_t
+histogram::count()
+{
+	uint64_t n = 0;
+	for (int i = 0; i < STAT_SHARDS; i++)
+		n += __atomic_load_n(&shards_[i].count, __ATOMIC_RELAXED);
+	return n;
+}
+
+uint64_t
+histogram::max()
+{
+	uint64_t m = 0;
+	for (int i = 0; i < STAT_SHARDS; i++) {
+		uint64_t v = __atomic_load_n(&shards_[i].max, __ATOMIC_RELAXED);
+		if (v > m)
+			m = v;
+	}
+	return m;
+}
+
+uint64_t
+histogram::percentile(double q)
+{
+	uint64_t buckets[HIST_BUCKETS];
+	uint64_t n = 0;
+
+	memset(buckets, 0, sizeof(buckets));
+	for (int i = 0; i < STAT_SHARDS; i++) {
+		for (int b = 0; b < HIST_BUCKETS; b++) {
+			uint64_t c = __atomic_load_n(&shards_[i].buckets[b], __ATOMIC_RELAXED);
+			buckets[b] += c;
+			n += c;
+		}
+	}
+	if (n == 0)
+		return 0;
+
+	uint64_t want = (uint64_t) (q * n);
+	if (want >= n)
+		want = n - 1;
+	uint64_t seen = 0;
+	int b;
+	for (b = 0; b < HIST_BUCKETS - 1; b++) {
+		seen += buckets[b];
+		if (seen > want)
+			break;
+	}
+	uint64_t m = max();
+	return bucket_high(b) < m ? bucket_high(b) : m;
+}
+
+std::string
+stats_dump()
+{
+	std::multimap<std::string, std::string> lines;
+	char line[256];
+
+	{
+		ScopedLock ml(&registry().m);
+		std::set<stat_counter *>::iterator c;
+		for (c = registry().counters.begin(); c != registry().counters.end(); ++c) {
+			snprintf(line, sizeof(line), "%s %llu\n", (*c)->name().c_str(),
+					(unsigned long long) (*c)->value());
+			lines.insert(std::make_pair((*c)->name(), std::string(line)));
+		}
+		std::set<histogram *>::iterator h;
+		for (h = registry().histograms.begin(); h != registry().histograms.end(); ++h) {
+			snprintf(line, sizeof(line),
+					"%s count=%llu p50=%llu p99=%llu p999=%llu max=%llu\n",
+					(*h)->name().c_str(),
+					(unsigned long long) (*h)->count(),
+					(unsigned long long) (*h)->percentile(0.5),
+					(unsigned long long) (*h)->percentile(0.99),
+					(unsigned long long) (*h)->percentile(0.999),
+					(unsigned long long) (*h)->max());
+			lines.insert(std::make_pair((*h)->name(), std::string(line)));
+		}
+	}
+
+	std::string out;
+	std::multimap<std::string, std::string>::iterator i;
+	for (i = lines.begin(); i != lines.end(); ++i)
+		out += i->second;
+	return out;
+}
+
+uint64_t
+stats_counter_value(const std::string &name)
+{
+	uint64_t v = 0;
+	ScopedLock ml(&registry().m);
+	std::set<stat_counter *>::iterator c;
+	for (c = registry().counters.begin(); c != registry().counters.end(); ++c) {
+		if ((*c)->name() == name)
+			v += (*c)->value();
+	}
+	return v;
+}
@@ -0,0 +1,78 @@
+#ifndef stats_h
+#define stats_h
+
+// lock-free counters and log-linear (HDR-style) histograms.
+//
+// an update is a relaxed atomic add into the calling thread's shard, so
+// threads do not share cache lines; readers sum the shards. every
+// instance registers under a name and is reported by stats_dump(),
+// which backs the rpc_const::stats procedure.
+
+#include <stdint.h>
+#include <string>
+
+enum {
+	STAT_SHARDS = 16,
+	// histogram buckets: values below 2^HIST_SUB_BITS+1 exactly, then
+	// 2^HIST_SUB_BITS buckets per power of two up to 2^HIST_MAX_BITS.
+	HIST_SUB_BITS = 3,
+	HIST_MAX_BITS = 40,
+	HIST_LINEAR = 1 << (HIST_SUB_BITS + 1),
+	HIST_BUCKETS = HIST_LINEAR + (HIST_MAX_BITS - HIST_SUB_BITS - 1) * (1 << HIST_SUB_BITS),
+};
+
+// index of the calling thread's shard
+int stat_shard();
+
+class stat_counter {
+	public:
+		stat_counter(const std::string &name);
+		~stat_counter();
+
+		void add(uint64_t n = 1) {
+			__atomic_fetch_add(&shards_[stat_shard()].v, n, __ATOMIC_RELAXED);
+		}
+		uint64_t value();
+		const std::string &name() { return name_; }
+
+	private:
+		struct shard {
+			uint64_t v;
+		} __attribute__((aligned(64)));
+
+		std::string name_;
+		shard shards_[STAT_SHARDS];
+};
+
+class histogram {
+	public:
+		histogram(const std::string &name);
+		~histogram();
+
+		void record(uint64_t v);
+		uint64_t count();
+		// smallest bucket bound covering fraction q of the samples
+		uint64_t percentile(double q);
+		uint64_t max();
+		const std::string &name() { return name_; }
+
+	private:
+		struct shard {
+			uint64_t count;
+			uint64_t max;
+			uint64_t buckets[HIST_BUCKETS];
+		} __attribute__((aligned(64)));
+
+		static int bucket(uint64_t v);
+		static uint64_t bucket_high(int b);
+
+		std::string name_;
+		shard shards_[STAT_SHARDS];
+};
+
+// one line per registered counter and histogram
+std::string stats_dump();
+// the sum of the counters registered as name, 0 if there are none
+uint64_t stats_counter_value(const std::string &name);
+
+#endif
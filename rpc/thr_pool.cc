@@ -0,0 +1,326 @@
+#include <errno.h>
+#include <sched.h>
+#include <sys/time.h>
+
+#include "thr_pool.h"
+#include "method_thread.h"
+#include "thread_layout.h"
+#include "slock.h"
+#include "stats.h"
+
+static stat_counter thr_steals("thrpool.steals");
+static stat_counter thr_grows("thrpool.grows");
+static stat_counter thr_shrinks("thrpool.shrinks");
+static stat_counter thr_local("thrpool.local");
+static stat_counter thr_dropped("thrpool.dropped");
+
+// the pool and slot of the calling thread, if it is a worker
+static __thread ThrPool *cur_pool;
+static __thread int cur_id;
+
+static long long
+ts_ns(const struct timespec &t)
+{
+	return t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+ThrPool::ThrPool(int sz, bool blocking)
+{
+	init(sz, sz, blocking);
+}
+
+ThrPool::ThrPool(int minthreads, int maxthreads, bool blocking)
+{
+	init(minthreads, maxthreads, blocking);
+}
+
+void
+ThrPool::init(int minthreads, int maxthreads, bool blocking)
+{
+	VERIFY(minthreads >= 1 && maxthreads >= minthreads);
+	min_ = minthreads;
+	max_ = maxthreads;
+	blockadd_ = blocking;
+	qmax_ = THR_QUEUE_PER_THREAD * maxthreads;
+	rr_ = 0;
+	pending_ = 0;
+	idle_ = 0;
+	nth_ = 0;
+	adders_ = 0;
+	adding_ = 0;
+	stop_ = false;
+
+	VERIFY(pthread_mutex_init(&m_, 0) == 0);
+	VERIFY(pthread_cond_init(&work_c_, 0) == 0);
+	VERIFY(pthread_cond_init(&space_c_, 0) == 0);
+
+	w_.resize(max_);
+	for (int i = 0; i < max_; i++) {
+		VERIFY(pthread_mutex_init(&w_[i].m, 0) == 0);
+		w_[i].ring.resize(16);
+		w_[i].head = 0;
+		w_[i].n = 0;
+		w_[i].running = false;
+		w_[i].joinable = false;
+		w_[i].cpu = thread_layout_place(THR_ROLE_WORKER, i).cpu;
+		if (w_[i].cpu < 0)
+			continue;
+		if ((int) by_cpu_.size() <= w_[i].cpu)
+			by_cpu_.resize(w_[i].cpu + 1, -1);
+		if (by_cpu_[w_[i].cpu] < 0)
+			by_cpu_[w_[i].cpu] = i;
+	}
+
+	ScopedLock ml(&m_);
+	for (int i = 0; i < min_; i++)
+		spawn();
+}
+
+ThrPool::~ThrPool()
+{
+	waitDone();
+	for (int i = 0; i < max_; i++)
+		VERIFY(pthread_mutex_destroy(&w_[i].m) == 0);
+	VERIFY(pthread_mutex_destroy(&m_) == 0);
+	VERIFY(pthread_cond_destroy(&work_c_) == 0);
+	VERIFY(pthread_cond_destroy(&space_c_) == 0);
+}
+
+void
+ThrPool::waitDone()
+{
+	{
+		ScopedLock ml(&m_);
+		__atomic_store_n(&stop_, true, __ATOMIC_SEQ_CST);
+		VERIFY(pthread_cond_broadcast(&work_c_) == 0);
+		VERIFY(pthread_cond_broadcast(&space_c_) == 0);
+	}
+	// no worker spawns once stop_ is set
+	for (int i = 0; i < max_; i++) {
+		if (w_[i].joinable) {
+			VERIFY(pthread_join(w_[i].th, NULL) == 0);
+			w_[i].joinable = false;
+		}
+	}
+	// an addJob() that saw stop_ still false may push after the last
+	// worker left; wait it out and reject what it queued
+	while (__atomic_load_n(&adding_, __ATOMIC_SEQ_CST) > 0)
+		sched_yield();
+	job j;
+	for (int i = 0; i < max_; i++) {
+		while (pop(&w_[i], &j)) {
+			__atomic_sub_fetch(&pending_, 1, __ATOMIC_SEQ_CST);
+			thr_dropped.add();
+			j.run(&j, false);
+		}
+	}
+}
+
+int
+ThrPool::nthreads()
+{
+	ScopedLock ml(&m_);
+	return nth_;
+}
+
+// start a worker in a free slot; caller holds m_
+void
+ThrPool::spawn()
+{
+	for (int i = 0; i < max_; i++) {
+		worker &w = w_[i];
+		if (w.running)
+			continue;
+		// a worker that shrank away has already dropped m_ for good
+		if (w.joinable)
+			VERIFY(pthread_join(w.th, NULL) == 0);
+		__atomic_store_n(&w.running, true, __ATOMIC_RELAXED);
+		w.joinable = true;
+		__atomic_store_n(&nth_, nth_ + 1, __ATOMIC_RELAXED);
+		w.th = method_thread(thread_layout_place(THR_ROLE_WORKER, i),
+				this, false, &ThrPool::loop, i);
+		return;
+	}
+}
+
+void
+ThrPool::push(worker *w, job &j)
+{
+	ScopedLock ml(&w->m);
+	if (w->n == w->ring.size()) {
+		std::vector<job> r(w->ring.size() * 2);
+		for (unsigned i = 0; i < w->n; i++)
+			r[i] = w->ring[(w->head + i) % w->ring.size()];
+		w->ring.swap(r);
+		w->head = 0;
+	}
+	w->ring[(w->head + w->n) % w->ring.size()] = j;
+	__atomic_store_n(&w->n, w->n + 1, __ATOMIC_RELAXED);
+}
+
+bool
+ThrPool::pop(worker *w, job *j)
+{
+	ScopedLock ml(&w->m);
+	if (!w->n)
+		return false;
+	*j = w->ring[w->head];
+	w->head = (w->head + 1) % w->ring.size();
+	__atomic_store_n(&w->n, w->n - 1, __ATOMIC_RELAXED);
+	return true;
+}
+
+// the running worker pinned to the caller's cpu, if any
+ThrPool::worker *
+ThrPool::local_worker()
+{
+#ifdef __linux__
+	if (by_cpu_.empty())
+		return NULL;
+	int c = sched_getcpu();
+	if (c < 0 || c >= (int) by_cpu_.size() || by_cpu_[c] < 0)
+		return NULL;
+	worker *w = &w_[by_cpu_[c]];
+	return __atomic_load_n(&w->running, __ATOMIC_RELAXED) ? w : NULL;
+#else
+	return NULL;
+#endif
+}
+
+bool
+ThrPool::addJob(job &j)
+{
+	clock_gettime(CLOCK_MONOTONIC, &j.queued);
+
+	if (__atomic_load_n(&pending_, __ATOMIC_RELAXED) >= qmax_) {
+		ScopedLock ml(&m_);
+		if (!blockadd_)
+			return false;
+		adders_++;
+		while (pending_ >= qmax_ && !stop_)
+			VERIFY(pthread_cond_wait(&space_c_, &m_) == 0);
+		adders_--;
+	}
+	// pairs with waitDone(): it either sees adding_ or we see stop_
+	__atomic_add_fetch(&adding_, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&stop_, __ATOMIC_SEQ_CST)) {
+		__atomic_sub_fetch(&adding_, 1, __ATOMIC_SEQ_CST);
+		return false;
+	}
+
+	worker *w;
+	if (cur_pool == this) {
+		w = &w_[cur_id];
+	} else if ((w = local_worker()) != NULL) {
+		thr_local.add();
+	} else {
+		unsigned i = __atomic_fetch_add(&rr_, 1, __ATOMIC_RELAXED) % max_;
+		for (int k = 0; k < max_ &&
+				!__atomic_load_n(&w_[i].running, __ATOMIC_RELAXED); k++)
+			i = (i + 1) % max_;
+		w = &w_[i];
+	}
+
+	// count it first so that no worker parks while it is being pushed
+	__atomic_add_fetch(&pending_, 1, __ATOMIC_SEQ_CST);
+	push(w, j);
+	if (__atomic_load_n(&idle_, __ATOMIC_SEQ_CST) > 0) {
+		ScopedLock ml(&m_);
+		VERIFY(pthread_cond_signal(&work_c_) == 0);
+	}
+	__atomic_sub_fetch(&adding_, 1, __ATOMIC_SEQ_CST);
+	return true;
+}
+
+// a job from our own deque, else stolen from another worker's
+bool
+ThrPool::take(int id, job *j)
+{
+	bool got = pop(&w_[id], j);
+	for (int k = 1; !got && k < max_; k++) {
+		worker *v = &w_[(id + k) % max_];
+		if (__atomic_load_n(&v->n, __ATOMIC_RELAXED) && pop(v, j)) {
+			thr_steals.add();
+			got = true;
+		}
+	}
+	if (!got)
+		return false;
+
+	__atomic_sub_fetch(&pending_, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&adders_, __ATOMIC_RELAXED) > 0) {
+		ScopedLock ml(&m_);
+		VERIFY(pthread_cond_signal(&space_c_) == 0);
+	}
+	return true;
+}
+
+// sleep until there is work; false if this worker should exit
+bool
+ThrPool::park(int id)
+{
+	ScopedLock ml(&m_);
+	bool ret = true;
+	__atomic_add_fetch(&idle_, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&pending_, __ATOMIC_SEQ_CST) == 0) {
+		if (stop_) {
+			ret = false;
+			break;
+		}
+		struct timeval now;
+		gettimeofday(&now, NULL);
+		struct timespec deadline;
+		deadline.tv_sec = now.tv_sec + THR_IDLE_MS / 1000;
+		deadline.tv_nsec = now.tv_usec * 1000 + (THR_IDLE_MS % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		int r = pthread_cond_timedwait(&work_c_, &m_, &deadline);
+		if (r == ETIMEDOUT && pending_ == 0 && nth_ > min_) {
+			thr_shrinks.add();
+			ret = false;
+			break;
+		}
+	}
+	__atomic_sub_fetch(&idle_, 1, __ATOMIC_SEQ_CST);
+	if (!ret) {
+		__atomic_store_n(&nth_, nth_ - 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&w_[id].running, false, __ATOMIC_RELAXED);
+	}
+	return ret;
+}
+
+void
+ThrPool::runJob(job &j)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (ts_ns(now) - ts_ns(j.queued) > THR_GROW_NS &&
+			__atomic_load_n(&idle_, __ATOMIC_SEQ_CST) == 0 &&
+			__atomic_load_n(&nth_, __ATOMIC_RELAXED) < max_) {
+		ScopedLock ml(&m_);
+		if (!stop_ && nth_ < max_ && idle_ == 0) {
+			thr_grows.add();
+			spawn();
+		}
+	}
+	j.run(&j, true);
+}
+
+void
+ThrPool::loop(int id)
+{
+	cur_pool = this;
+	cur_id = id;
+	job j;
+	while (1) {
+		if (take(id, &j)) {
+			runJob(j);
+			continue;
+		}
+		if (!park(id))
+			break;
+	}
+	cur_pool = NULL;
+}
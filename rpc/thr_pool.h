@@ -1,66 +1,169 @@
 #ifndef __THR_POOL__
 #define __THR_POOL__
 
+// work-stealing thread pool.
+//
+// each worker has its own job deque. addObjJob() from a worker pushes
+// onto that worker's deque; from any other thread it deals jobs out
+// round-robin. a worker runs its own jobs oldest first and, when it has
+// none, steals the oldest job from another worker before it sleeps.
+//
+// jobs are stored by value: the object, method and argument are
+// constructed inside the job when they fit in THR_JOB_INLINE bytes and
+// are plain data (pointers, ints), so adding a job allocates nothing in
+// the common case, and a slab block (slab.h) otherwise.
+//
+// the pool starts minthreads workers and grows towards maxthreads when a
+// job waited longer than THR_GROW_NS with every worker busy, e.g. behind
+// a slow handler. workers idle for THR_IDLE_MS exit down to minthreads.
+//
+// workers are started as THR_ROLE_WORKER threads (thread_layout.h).
+// when those are pinned, a job added by a thread that is not a worker,
+// e.g. a reactor loop, goes to the worker pinned to the adder's cpu.
+
+#include <new>
 #include <pthread.h>
+#include <time.h>
+#include <type_traits>
 #include <vector>
 
-#include "fifo.h"
+#include "slab.h"
+
+enum {
+	THR_JOB_INLINE = 48,
+	THR_GROW_NS = 1000000,   // queue wait that justifies another thread
+	THR_IDLE_MS = 5000,      // idle time before a worker above min exits
+	THR_QUEUE_PER_THREAD = 100,
+};
 
 class ThrPool {
 
 
 	public:
-		struct job_t {
-			void *(*f)(void *); //function point
-			void *a; //function arguments
+		struct job {
+			// call the method (unless call is false), then destroy it
+			void (*run)(job *, bool call);
+			union {
+				char buf[THR_JOB_INLINE];
+				void *align_;
+			};
+			struct timespec queued;
 		};
 
+		// a fixed pool of sz workers
 		ThrPool(int sz, bool blocking=true);
+		// between minthreads and maxthreads workers
+		ThrPool(int minthreads, int maxthreads, bool blocking);
 		~ThrPool();
 		template<class C, class A> bool addObjJob(C *o, void (C::*m)(A), A a);
+		// run the queued jobs, then stop and join the workers
 		void waitDone();
 
-		bool takeJob(job_t *j);
+		int nthreads();
 
 	private:
-		pthread_attr_t attr_;
-		int nthreads_;
+		struct worker {
+			pthread_mutex_t m;
+			std::vector<job> ring;  // jobs[head .. head+n), wrapping
+			unsigned head;
+			unsigned n;
+			pthread_t th;
+			bool running;
+			bool joinable;
+			int cpu;  // pinned to, or -1
+		} __attribute__((aligned(64)));
+
+		int min_;
+		int max_;
 		bool blockadd_;
+		unsigned qmax_;          // queued jobs before addJob blocks or fails
+
+		std::vector<worker> w_;
+		std::vector<int> by_cpu_; // cpu -> first worker pinned to it, or -1
+		unsigned rr_;            // next deque for jobs from non-workers
+		unsigned pending_;       // queued, not yet taken
+		unsigned idle_;          // workers asleep in park()
+		int nth_;                // workers running, under m_
+		int adders_;             // addJob()s waiting for space, under m_
+		unsigned adding_;        // addJob()s past their stop_ check
+		bool stop_;
+
+		pthread_mutex_t m_;
+		pthread_cond_t work_c_;  // pending_ went non-zero, or stop_
+		pthread_cond_t space_c_; // pending_ dropped below qmax_
+
+		void init(int minthreads, int maxthreads, bool blocking);
+		bool addJob(job &j);
+		worker *local_worker();
+		void push(worker *w, job &j);
+		bool pop(worker *w, job *j);
+		bool take(int id, job *j);
+		bool park(int id);
+		void spawn();
+		void runJob(job &j);
+		void loop(int id);
+
+		template<class W> static void run_inline(job *j, bool call);
+		template<class W> static void run_heap(job *j, bool call);
+		template<class W> static void make_job(job &j, const W &w, std::true_type);
+		template<class W> static void make_job(job &j, const W &w, std::false_type);
+};
 
+template<class W> void
+ThrPool::run_inline(job *j, bool call)
+{
+	W *w = (W *) j->buf;
+	if (call)
+		w->call();
+	w->~W();
+}
+
+template<class W> void
+ThrPool::run_heap(job *j, bool call)
+{
+	W *w = *(W **) j->buf;
+	if (call)
+		w->call();
+	w->~W();
+	slab_free(w);
+}
 
-		fifo<job_t> jobq_;
-		std::vector<pthread_t> th_;
+template<class W> void
+ThrPool::make_job(job &j, const W &w, std::true_type)
+{
+	new (j.buf) W(w);
+	j.run = &run_inline<W>;
+}
 
-		bool addJob(void *(*f)(void *), void *a);
-};
+template<class W> void
+ThrPool::make_job(job &j, const W &w, std::false_type)
+{
+	*(W **) j.buf = new (slab_alloc(sizeof(W))) W(w);
+	j.run = &run_heap<W>;
+}
 
-	template <class C, class A> bool 
+	template <class C, class A> bool
 ThrPool::addObjJob(C *o, void (C::*m)(A), A a)
 {
 
-	class objfunc_wrapper {
-		public:
-			C *o;
-			void (C::*m)(A a);
-			A a;
-			static void *func(void *vvv) {
-				objfunc_wrapper *x = (objfunc_wrapper*)vvv;
-				C *o = x->o;
-				void (C::*m)(A ) = x->m;
-				A a = x->a;
-				(o->*m)(a);
-				delete x;
-				return 0;
-			}
+	struct objfunc_wrapper {
+		objfunc_wrapper(C *_o, void (C::*_m)(A), A _a) : o(_o), m(_m), a(_a) { }
+		C *o;
+		void (C::*m)(A a);
+		A a;
+		void call() { (o->*m)(a); }
 	};
 
-	objfunc_wrapper *x = new objfunc_wrapper;
-	x->o = o;
-	x->m = m;
-	x->a = a;
-	return addJob(&objfunc_wrapper::func, (void *)x);
+	job j;
+	// jobs are moved between deques as plain bytes
+	make_job(j, objfunc_wrapper(o, m, a), std::integral_constant<bool,
+			sizeof(objfunc_wrapper) <= THR_JOB_INLINE &&
+			std::is_trivially_copyable<objfunc_wrapper>::value>());
+	if (addJob(j))
+		return true;
+	j.run(&j, false);
+	return false;
 }
 
 
 #endif
-
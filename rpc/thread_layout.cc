@@ -0,0 +1,170 @@
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "thread_layout.h"
+#include "slock.h"
+
+#ifndef CPU_SETSIZE
+#define CPU_SETSIZE 1024
+#endif
+
+struct role_layout {
+	role_layout() : stack(0) { }
+	std::vector<int> cpus;
+	size_t stack;  // 0 for method_thread's default
+};
+
+static const char *const role_names[THR_ROLE_COUNT] = {
+	"reactor", "accept", "worker",
+};
+
+static role_layout layout[THR_ROLE_COUNT];
+static pthread_mutex_t layout_m = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t layout_once = PTHREAD_ONCE_INIT;
+
+// "0-3,8" into cpus, each of which this process may run on: a thread
+// pinned anywhere else couldn't be started
+static bool
+parse_cpus(const char *s, int len, std::vector<int> *cpus)
+{
+#ifdef __linux__
+	cpu_set_t allowed;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return false;
+#endif
+	const char *end = s + len;
+	while (s < end) {
+		char *e;
+		long lo = strtol(s, &e, 10), hi = lo;
+		if (e == s)
+			return false;
+		if (e < end && *e == '-') {
+			s = e + 1;
+			hi = strtol(s, &e, 10);
+			if (e == s)
+				return false;
+		}
+		if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+			return false;
+		for (long c = lo; c <= hi; c++) {
+#ifdef __linux__
+			if (!CPU_ISSET(c, &allowed)) {
+				fprintf(stderr, "thread layout: cpu %ld is outside this "
+						"process's affinity mask\n", c);
+				return false;
+			}
+#endif
+			cpus->push_back(c);
+		}
+		if (e < end && *e != ',')
+			return false;
+		s = e < end ? e + 1 : end;
+	}
+	return true;
+}
+
+// "256k" into bytes
+static bool
+parse_stack(const char *s, int len, size_t *stack)
+{
+	char *e;
+	unsigned long v = strtoul(s, &e, 10);
+	if (e == s)
+		return false;
+	if (e < s + len && (*e == 'k' || *e == 'K')) {
+		v <<= 10;
+		e++;
+	} else if (e < s + len && (*e == 'm' || *e == 'M')) {
+		v <<= 20;
+		e++;
+	}
+	if (e != s + len || v < (unsigned long) PTHREAD_STACK_MIN)
+		return false;
+	*stack = v;
+	return true;
+}
+
+static bool
+parse_layout(const char *spec, role_layout *out)
+{
+	const char *s = spec;
+	while (*s) {
+		const char *end = strchr(s, ';');
+		int len = end ? end - s : strlen(s);
+		const char *eq = (const char *) memchr(s, '=', len);
+		if (!eq)
+			return false;
+		int r;
+		for (r = 0; r < THR_ROLE_COUNT; r++) {
+			if ((int) strlen(role_names[r]) == eq - s &&
+					!strncmp(s, role_names[r], eq - s))
+				break;
+		}
+		if (r == THR_ROLE_COUNT)
+			return false;
+		const char *v = eq + 1;
+		const char *at = (const char *) memchr(v, '@', s + len - v);
+		if (!parse_cpus(v, (at ? at : s + len) - v, &out[r].cpus))
+			return false;
+		if (at && !parse_stack(at + 1, s + len - at - 1, &out[r].stack))
+			return false;
+		s = end ? end + 1 : s + len;
+	}
+	return true;
+}
+
+static void
+layout_init()
+{
+	const char *e = getenv("RPC_THREAD_LAYOUT");
+	if (!e)
+		return;
+	role_layout l[THR_ROLE_COUNT];
+	if (!parse_layout(e, l)) {
+		fprintf(stderr, "RPC_THREAD_LAYOUT: can't parse \"%s\"\n", e);
+		return;
+	}
+	for (int r = 0; r < THR_ROLE_COUNT; r++)
+		layout[r] = l[r];
+}
+
+bool
+thread_layout_set(const char *spec)
+{
+	pthread_once(&layout_once, layout_init);
+	role_layout l[THR_ROLE_COUNT];
+	if (!parse_layout(spec, l))
+		return false;
+	ScopedLock ml(&layout_m);
+	for (int r = 0; r < THR_ROLE_COUNT; r++)
+		layout[r] = l[r];
+	return true;
+}
+
+thread_place
+thread_layout_place(int role, int idx)
+{
+	pthread_once(&layout_once, layout_init);
+	VERIFY(role >= 0 && role < THR_ROLE_COUNT && idx >= 0);
+	thread_place pl;
+	ScopedLock ml(&layout_m);
+	const role_layout &l = layout[role];
+	if (!l.cpus.empty())
+		pl.cpu = l.cpus[idx % l.cpus.size()];
+	if (l.stack)
+		pl.stack = l.stack;
+	return pl;
+}
+
+bool
+thread_layout_pinned(int role)
+{
+	pthread_once(&layout_once, layout_init);
+	VERIFY(role >= 0 && role < THR_ROLE_COUNT);
+	ScopedLock ml(&layout_m);
+	return !layout[role].cpus.empty();
+}
@@ -0,0 +1,44 @@
+#ifndef thread_layout_h
+#define thread_layout_h
+
+// which cpus the rpc library's threads run on, and their stack sizes.
+//
+// RPC_THREAD_LAYOUT, or thread_layout_set(), gives each role a list of
+// cpus and optionally a stack size:
+//
+//	reactor=0-3@64k;worker=0-3,8-11@256k;accept=4
+//
+// thread i of a role is pinned to entry i of its list, wrapping. a role
+// that isn't listed floats and keeps method_thread's 100 KB stack.
+// giving reactor loops and pool workers the same cpus lets ThrPool hand
+// a job queued by a loop to the worker on the loop's cpu, so a request
+// is handled in the cache it was read into.
+
+#include <stddef.h>
+
+struct thread_place {
+	// 100K stacks by default, so we don't run out of memory
+	thread_place() : stack(100*1024), cpu(-1) { }
+	size_t stack;
+	int cpu;  // run only on this cpu; -1 for anywhere
+};
+
+enum thread_role {
+	THR_ROLE_REACTOR,  // Reactor event loops
+	THR_ROLE_ACCEPT,   // listeners' accept threads
+	THR_ROLE_WORKER,   // ThrPool workers
+	THR_ROLE_COUNT,
+};
+
+// replace the layout with spec; false, leaving it alone, if spec is
+// malformed or names a cpu outside the process's affinity mask. only
+// threads started afterwards are placed by it.
+bool thread_layout_set(const char *spec);
+
+// how to start thread idx of role
+thread_place thread_layout_place(int role, int idx);
+
+// whether role's threads are pinned
+bool thread_layout_pinned(int role);
+
+#endif
@@ -0,0 +1,238 @@
+#include <signal.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "trace.h"
+#include "slock.h"
+
+int trace_level = JSL_DBG_2;
+
+namespace {
+
+// one record. seq is odd while the owning thread is writing the slot, so
+// a concurrent trace_dump() can tell a torn copy from a complete one.
+struct trace_slot {
+	uint32_t seq;
+	uint16_t level;
+	uint16_t len;
+	uint64_t ns;
+	unsigned long tid;  // a ring outlives its threads
+	char msg[TRACE_MSG_SZ];
+};
+
+struct trace_ring {
+	uint32_t head;  // only written by the owning thread
+	trace_ring *next_spare;
+	trace_slot slots[TRACE_RING_SLOTS];
+};
+
+pthread_mutex_t rings_m = PTHREAD_MUTEX_INITIALIZER;
+std::vector<trace_ring *> *rings;  // every ring ever created, never freed
+trace_ring *spares;                // rings whose threads have exited
+pthread_once_t ring_once = PTHREAD_ONCE_INIT;
+pthread_key_t ring_key;
+__thread trace_ring *my_ring;
+
+// the thread is exiting. its records stay readable; the next new
+// thread writes on after them.
+void
+ring_exit(void *a)
+{
+	trace_ring *r = (trace_ring *) a;
+	my_ring = NULL;
+	ScopedLock ml(&rings_m);
+	r->next_spare = spares;
+	spares = r;
+}
+
+void
+ring_key_init()
+{
+	VERIFY(pthread_key_create(&ring_key, ring_exit) == 0);
+}
+
+trace_ring *
+get_ring()
+{
+	if (my_ring)
+		return my_ring;
+	pthread_once(&ring_once, ring_key_init);
+	trace_ring *r;
+	{
+		ScopedLock ml(&rings_m);
+		r = spares;
+		if (r) {
+			spares = r->next_spare;
+		} else {
+			r = (trace_ring *) calloc(1, sizeof(trace_ring));
+			VERIFY(r);
+			if (!rings)
+				rings = new std::vector<trace_ring *>;
+			rings->push_back(r);
+		}
+	}
+	VERIFY(pthread_setspecific(ring_key, r) == 0);
+	my_ring = r;
+	return r;
+}
+
+struct trace_rec {
+	uint64_t ns;
+	int level;
+	unsigned long tid;
+	std::string msg;
+	bool operator<(const trace_rec &o) const { return ns < o.ns; }
+};
+
+void
+dump_at_exit()
+{
+	trace_dump(stderr);
+}
+
+const int fatal_signals[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+
+// the process is dying: write what the rings hold straight to stderr,
+// thread by thread, without trace_dump()'s allocation and sorting. the
+// rings are skipped if the crash came while rings_m was held. snprintf
+// isn't async-signal-safe on paper, but nothing else will run again.
+void
+dump_on_signal(int sig)
+{
+	if (pthread_mutex_trylock(&rings_m) == 0) {
+		for (unsigned i = 0; rings && i < rings->size(); i++) {
+			trace_ring *r = (*rings)[i];
+			uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+			uint32_t n = std::min(head, (uint32_t) TRACE_RING_SLOTS);
+			for (uint32_t j = head - n; j != head; j++) {
+				trace_slot &s = r->slots[j & (TRACE_RING_SLOTS - 1)];
+				if (__atomic_load_n(&s.seq, __ATOMIC_ACQUIRE) != 2 * j + 2)
+					continue;
+				char line[64 + TRACE_MSG_SZ];
+				int len = snprintf(line, sizeof(line), "%llu.%09llu %lx [%d] %.*s",
+						(unsigned long long) (s.ns / 1000000000),
+						(unsigned long long) (s.ns % 1000000000),
+						s.tid, s.level, (int) s.len, s.msg);
+				len = std::min(len, (int) sizeof(line) - 1);
+				if (len > 0 && line[len - 1] != '\n')
+					line[len++] = '\n';
+				if (write(2, line, len) < 0)
+					break;
+			}
+		}
+		pthread_mutex_unlock(&rings_m);
+	}
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+struct trace_init {
+	trace_init() {
+		const char *e = getenv("RPC_TRACE");
+		if (e)
+			trace_level = atoi(e);
+		atexit(dump_at_exit);
+		// leave handlers the program installed alone
+		for (unsigned i = 0; i < sizeof(fatal_signals) / sizeof(fatal_signals[0]); i++) {
+			struct sigaction sa;
+			if (sigaction(fatal_signals[i], NULL, &sa) != 0 ||
+					sa.sa_handler != SIG_DFL)
+				continue;
+			memset(&sa, 0, sizeof(sa));
+			sa.sa_handler = dump_on_signal;
+			sigemptyset(&sa.sa_mask);
+			sa.sa_flags = SA_RESETHAND | SA_NODEFER;
+			sigaction(fatal_signals[i], &sa, NULL);
+		}
+	}
+} init_;
+
+}
+
+void
+trace_record(int level, const char *fmt, ...)
+{
+	trace_ring *r = get_ring();
+	uint32_t i = r->head;
+	trace_slot &s = r->slots[i & (TRACE_RING_SLOTS - 1)];
+
+	__atomic_store_n(&s.seq, 2 * i + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	s.ns = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+	s.level = level;
+	s.tid = (unsigned long) pthread_self();
+
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(s.msg, sizeof(s.msg), fmt, ap);
+	va_end(ap);
+	s.len = n < 0 ? 0 : std::min(n, (int) sizeof(s.msg) - 1);
+
+	__atomic_store_n(&s.seq, 2 * i + 2, __ATOMIC_RELEASE);
+	__atomic_store_n(&r->head, i + 1, __ATOMIC_RELEASE);
+}
+
+void
+trace_set_level(int level)
+{
+	trace_level = level;
+}
+
+// write out and consume every complete record, oldest first.
+void
+trace_dump(FILE *f)
+{
+	std::vector<trace_rec> recs;
+	{
+		ScopedLock ml(&rings_m);
+		if (!rings)
+			return;
+		for (unsigned i = 0; i < rings->size(); i++) {
+			trace_ring *r = (*rings)[i];
+			uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+			uint32_t n = std::min(head, (uint32_t) TRACE_RING_SLOTS);
+			for (uint32_t j = head - n; j != head; j++) {
+				trace_slot &s = r->slots[j & (TRACE_RING_SLOTS - 1)];
+				uint32_t seq = __atomic_load_n(&s.seq, __ATOMIC_ACQUIRE);
+				if (seq != 2 * j + 2)
+					continue;
+				trace_rec rec;
+				rec.ns = s.ns;
+				rec.level = s.level;
+				rec.tid = s.tid;
+				rec.msg.assign(s.msg, s.len);
+				__atomic_thread_fence(__ATOMIC_ACQUIRE);
+				if (__atomic_load_n(&s.seq, __ATOMIC_RELAXED) != seq)
+					continue;
+				// consumed; a later dump will not repeat it. loses to
+				// the writer if it has already reused the slot.
+				if (!__atomic_compare_exchange_n(&s.seq, &seq, 0, false,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+					continue;
+				recs.push_back(rec);
+			}
+		}
+	}
+
+	std::stable_sort(recs.begin(), recs.end());
+	for (unsigned i = 0; i < recs.size(); i++) {
+		fprintf(f, "%llu.%09llu %lx [%d] %s",
+				(unsigned long long) (recs[i].ns / 1000000000),
+				(unsigned long long) (recs[i].ns % 1000000000),
+				recs[i].tid, recs[i].level,
+				recs[i].msg.c_str());
+		if (recs[i].msg.empty() || recs[i].msg[recs[i].msg.size() - 1] != '\n')
+			fputc('\n', f);
+	}
+	fflush(f);
+}
@@ -0,0 +1,44 @@
+#ifndef trace_h
+#define trace_h
+
+// leveled tracing into per-thread ring buffers.
+//
+// trace_log(level, fmt, ...) uses the jsl_log levels (JSL_DBG_1 critical
+// ... JSL_DBG_4 debugging). records above TRACE_LEVEL are compiled out;
+// records above the runtime trace_level cost one branch. enabled records
+// are formatted into the calling thread's ring, overwriting the oldest,
+// and written out by trace_dump(). the runtime level comes from the
+// RPC_TRACE environment variable (default JSL_DBG_2); rings are dumped
+// to stderr at exit, or on a fatal signal (including the SIGABRT of a
+// failed VERIFY), if anything was recorded. a thread's ring goes to the
+// next new thread when it exits, so there are only ever as many rings
+// as threads once ran at the same time.
+
+#include <stdio.h>
+#include <stdint.h>
+#include "jsl_log.h"
+
+#ifndef TRACE_LEVEL
+#define TRACE_LEVEL 4
+#endif
+
+enum {
+	TRACE_RING_SLOTS = 1024,  // per thread, power of two
+	TRACE_MSG_SZ = 104,
+};
+
+extern int trace_level;
+
+#define trace_log(level, ...)                                     \
+	do {                                                        \
+		if ((level) <= TRACE_LEVEL &&                              \
+		    __builtin_expect(trace_level >= (level), 0))           \
+			trace_record((level), __VA_ARGS__);                    \
+	} while (0)
+
+void trace_record(int level, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+void trace_set_level(int level);
+void trace_dump(FILE *f);
+
+#endif
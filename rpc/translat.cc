@@ -0,0 +1,219 @@
+// transport latency benchmark: round trips of RPC-framed PDUs (4-byte
+// big-endian length, then the body) between two threads, over TCP
+// loopback, an AF_UNIX socket, and a shm_pair with eventfd wakeups.
+//
+// usage: translat [round-trips] [pdu-size ...]
+// prints one line per transport and size:
+//   transport bytes round-trips mean-us p50-us p99-us
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "shmring.h"
+#include "stats.h"
+#include "method_thread.h"
+
+// one direction of a transport: send a whole PDU, receive a whole PDU
+class endpoint {
+	public:
+		virtual ~endpoint() { }
+		virtual void put(const char *b, int sz) = 0;
+		virtual void get(char *b, int sz) = 0;
+
+		void send_pdu(std::vector<char> &pdu) {
+			put(&pdu[0], pdu.size());
+		}
+		void recv_pdu(std::vector<char> &pdu) {
+			uint32_t sz1;
+			get((char *) &sz1, sizeof(sz1));
+			pdu.resize(ntohl(sz1) + sizeof(sz1));
+			memcpy(&pdu[0], &sz1, sizeof(sz1));
+			get(&pdu[sizeof(sz1)], pdu.size() - sizeof(sz1));
+		}
+};
+
+class sock_endpoint : public endpoint {
+	public:
+		sock_endpoint(int fd) : fd_(fd) { }
+		~sock_endpoint() { close(fd_); }
+		void put(const char *b, int sz) {
+			while (sz > 0) {
+				ssize_t n = write(fd_, b, sz);
+				VERIFY(n > 0 || errno == EINTR);
+				if (n > 0) {
+					b += n;
+					sz -= n;
+				}
+			}
+		}
+		void get(char *b, int sz) {
+			while (sz > 0) {
+				ssize_t n = read(fd_, b, sz);
+				VERIFY(n > 0 || errno == EINTR);
+				if (n > 0) {
+					b += n;
+					sz -= n;
+				}
+			}
+		}
+	private:
+		int fd_;
+};
+
+class shm_endpoint : public endpoint {
+	public:
+		shm_endpoint(shm_pair *p, int door, int peerdoor)
+			: p_(p), door_(door), peerdoor_(peerdoor) { }
+		void put(const char *b, int sz) {
+			while (sz > 0) {
+				int n = p_->tx.write(b, sz);
+				b += n;
+				sz -= n;
+				if (n)
+					p_->tx.kick(peerdoor_);
+			}
+		}
+		void get(char *b, int sz) {
+			while (sz > 0) {
+				int n = p_->rx.read(b, sz);
+				b += n;
+				sz -= n;
+				if (!n && p_->rx.arm()) {
+					uint64_t v;
+					VERIFY(read(door_, &v, sizeof(v)) == sizeof(v));
+				}
+			}
+		}
+	private:
+		shm_pair *p_;
+		int door_;
+		int peerdoor_;
+};
+
+struct echo {
+	endpoint *ep;
+	int n;
+	void run() {
+		std::vector<char> pdu;
+		for (int i = 0; i < n; i++) {
+			ep->recv_pdu(pdu);
+			ep->send_pdu(pdu);
+		}
+	}
+};
+
+static void
+tcp_pair(int *a, int *b)
+{
+	int l = socket(AF_INET, SOCK_STREAM, 0);
+	VERIFY(l >= 0);
+	struct sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sin.sin_port = 0;
+	VERIFY(bind(l, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+	VERIFY(listen(l, 1) == 0);
+	socklen_t len = sizeof(sin);
+	VERIFY(getsockname(l, (struct sockaddr *) &sin, &len) == 0);
+
+	*a = socket(AF_INET, SOCK_STREAM, 0);
+	VERIFY(connect(*a, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+	*b = accept(l, NULL, NULL);
+	VERIFY(*b >= 0);
+	close(l);
+
+	int yes = 1;
+	setsockopt(*a, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+	setsockopt(*b, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+}
+
+static uint64_t
+now_ns()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t) t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static void
+run(const char *name, endpoint *cl, endpoint *srv, int sz, int n)
+{
+	echo e;
+	e.ep = srv;
+	e.n = n;
+	pthread_t th = method_thread(&e, false, &echo::run);
+
+	std::vector<char> pdu(sz + sizeof(uint32_t), 'x');
+	uint32_t sz1 = htonl(sz);
+	memcpy(&pdu[0], &sz1, sizeof(sz1));
+	std::vector<char> rep;
+
+	char hname[64];
+	snprintf(hname, sizeof(hname), "translat.%s.%d", name, sz);
+	histogram h(hname);
+	uint64_t total = 0;
+	for (int i = 0; i < n; i++) {
+		uint64_t start = now_ns();
+		cl->send_pdu(pdu);
+		cl->recv_pdu(rep);
+		uint64_t d = now_ns() - start;
+		h.record(d);
+		total += d;
+	}
+	VERIFY(rep == pdu);
+	VERIFY(pthread_join(th, NULL) == 0);
+
+	printf("%s %d %d %.2f %.2f %.2f\n", name, sz, n, total / 1000.0 / n,
+			h.percentile(0.50) / 1000.0, h.percentile(0.99) / 1000.0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int n = argc > 1 ? atoi(argv[1]) : 20000;
+	std::vector<int> sizes;
+	for (int i = 2; i < argc; i++)
+		sizes.push_back(atoi(argv[i]));
+	if (sizes.empty()) {
+		sizes.push_back(64);
+		sizes.push_back(4096);
+		sizes.push_back(65536);
+	}
+
+	printf("# transport bytes round-trips mean-us p50-us p99-us\n");
+	for (unsigned i = 0; i < sizes.size(); i++) {
+		int a, b;
+		tcp_pair(&a, &b);
+		sock_endpoint tc(a), ts(b);
+		run("tcp", &tc, &ts, sizes[i], n);
+
+		int sv[2];
+		VERIFY(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+		sock_endpoint uc(sv[0]), us(sv[1]);
+		run("unix", &uc, &us, sizes[i], n);
+
+		shm_pair cp, sp;
+		VERIFY(cp.create());
+		VERIFY(sp.attach(dup(cp.fd())));
+		int cdoor = eventfd(0, 0), sdoor = eventfd(0, 0);
+		VERIFY(cdoor >= 0 && sdoor >= 0);
+		shm_endpoint mc(&cp, cdoor, sdoor), ms(&sp, sdoor, cdoor);
+		run("shm", &mc, &ms, sizes[i], n);
+		close(cdoor);
+		close(sdoor);
+	}
+	return 0;
+}